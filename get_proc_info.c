@@ -1,104 +1,1252 @@
-/**
- * Wrapper User Space Application
- * 
- * This is a user space application written in C that allows for inserting and removing a kernel module
- * from the operating system and passing parameters to the kernel module. It also reads information from
- * the /proc file and prints the log messages in the terminal.
- * 
- * Command line arguments:
- * - argv[1]: User space application file path.
- * - argv[2]: Argument type, which can be -pid or -pname.
- * - argv[3]: If -pid is given, it will be a non-negative integer. Otherwise, if -pname is given, it will be a string.
- * 
- * Please ensure the correct number of command line arguments is passed. It must work with only one parameter,
- * and if both -pid and -pname information is given, it should give an error.
- * 
- * -pid is the equivalent of -upid in the kernel space, and -pname is the equivalent of -upname in the kernel space.
- * 
- * The flow:
- * - Get the process ID or name argument from the terminal.
- * - Pass the parameter to the kernel while the kernel object is inserted to the OS.
- * - Read log messages to be written by the kernel module from the /proc file.
- * - Print log messages in the terminal.
- * - Remove the kernel module.
- * - Exit the program with exit value 0.
- * 
- * If an error occurs in any of the above steps, print an appropriate error message and exit the program with exit value 1.
- * 
- * Authors:
- * - [ Burak Keçeci - 290201103 ][ Berkan Gönülsever - 270201064 ]
- * 
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-
-#define BUFFER_SIZE 256
-#define PROC_FILE "/proc/proc_info_module"
-
-/**
- * Prints an error message to stderr and exits the program with a non-zero exit code.
- * @param message The error message to be printed.
- */
-void display_error(const char *message);
-
-int main(int argc, char *argv[]) {
-    // Check the number of command line arguments
-    if (argc != 4) {
-        display_error("Invalid number of arguments. Usage: get_proc_info <app_path> <-pid|-pname> <value>");
-    }
-
-    // Parse command line arguments
-    char *app_path = argv[1];
-    char *arg_type = argv[2];
-    char *arg_value = argv[3];
-
-    // Check if both -pid and -pname are provided
-    if ((strcmp(arg_type, "-pid") == 0 && strcmp(arg_type, "-pname") == 0) ||
-        (strcmp(arg_type, "-pid") != 0 && strcmp(arg_type, "-pname") != 0)) {
-        display_error("Invalid argument type. Either -pid or -pname should be provided.");
-    }
-
-    // Create the command to insert the kernel module
-    char command[BUFFER_SIZE];
-    
-    if (strcmp(arg_type, "-pid") == 0) {
-        snprintf(command, BUFFER_SIZE, "insmod %s upid=%s", app_path, arg_value);
-    } else if (strcmp(arg_type, "-pname") == 0) {
-        snprintf(command, BUFFER_SIZE, "insmod %s upname=%s", app_path, arg_value);
-    } else {
-        display_error("Invalid argument type.");
-    }
-
-    // Insert the kernel module
-    if (system(command) != 0) {
-        display_error("Failed to insert the kernel module.");
-    }
-
-    // Read and print log messages from the /proc file
-    FILE *proc_file = fopen(PROC_FILE, "r");
-    if (proc_file == NULL) {
-        display_error("Failed to open the /proc file.");
-    }
-
-    char msg[BUFFER_SIZE];
-    while (fgets(msg, BUFFER_SIZE, proc_file) != NULL) {
-        printf("%s", msg);
-    }
-
-    fclose(proc_file);
-
-    // Remove the kernel module
-    if (system("rmmod proc_info_module") != 0) {
-        display_error("Failed to remove the kernel module.");
-    }
-
-    return 0;
-}
-
-void display_error(const char *message) {
-    fprintf(stderr, "Error: %s\n", message);
-    exit(1);
-}
+/**
+ * Wrapper User Space Application
+ * 
+ * This is a user space application written in C that allows for inserting and removing a kernel module
+ * from the operating system and passing parameters to the kernel module. It also reads information from
+ * the /proc file and prints the log messages in the terminal.
+ * 
+ * Command line arguments:
+ * - argv[1]: User space application file path.
+ * - argv[2]: Argument type, which can be -pid, -pname, -pids, -pfile, -bench, -snapshot, -top, -tree, -threads or
+ *            -events, or --daemon.
+ * - argv[3]: If -pid is given, it will be a non-negative integer. Otherwise, if -pname is given, it will be a string.
+ *            -pname also takes a comma separated list of names, and every name may be a prefix like "php-fpm*" or a
+ *            glob like "kworker/?:*". The module matches all of them in one scan and reports the name each match hit.
+ *            -pids takes a comma separated list of process IDs, and -pfile takes a file listing one process ID
+ *            or process name per line. Batches are answered by the module in a single read.
+ *            -bench takes a comma separated list of record counts, e.g. 1,100,10000, and prints the
+ *            per-record cost of formatting that many records in the module. At most 32 counts adding up to
+ *            200000 records are accepted.
+ *            -snapshot takes no value and reports every process in the system with one compact line each.
+ *            -top takes a count N and reports like -snapshot only the N processes using the most resident memory, or
+ *            the most of the resource given by -key, highest first. The module ranks the processes during its walk
+ *            of the task list, so at most N records are formatted and copied.
+ *            -events takes no value and prints the fork, exec and exit of every process as they happen until the
+ *            application is interrupted with Ctrl-C, including the exit status and peak memory usage of exiting
+ *            processes. Only -binary and -timing can follow it.
+ *            -tree takes a process ID and reports the process and all of its descendants, indented by depth,
+ *            followed by the process count and aggregate memory usage of the subtree.
+ *            -threads takes a process ID and reports every thread of the process with its TID, name, state and
+ *            CPU time.
+ * - argv[4...]: Optional flags.
+ *   -all: With -pname or -pfile, every process with a given name is reported instead of only the first one,
+ *         followed by the match count and aggregate memory usage of each name.
+ *   -binary: The module sends fixed-size binary records (see proc_info_module.h), which are decoded here and
+ *            printed as one tab separated line per process.
+ *   -interval <MS>: The module samples the targets every MS milliseconds into its sample rings, and the samples
+ *                   are printed as they arrive until the application is interrupted with Ctrl-C.
+ *   -mmap: With -interval, the samples are stored in a ring shared with the module and consumed through mmap
+ *          instead of being read from the /proc file.
+ *   -timing: The time spent loading the module, answering the query and unloading the module is printed to stderr.
+ *   --client: The query is sent to a running daemon instead of the module, which is neither loaded nor unloaded.
+ *   -watch <MS>: The targets are read again every MS milliseconds from the same open /proc file until the application
+ *                is interrupted with Ctrl-C, and every sample is printed as one line with the change of its memory
+ *                usage and state since the previous sample, and the CPU usage of the process between the samples.
+ *   -filter <FILTER>: With -snapshot or -top, only the processes matching every predicate of FILTER are reported. FILTER
+ *                     holds whitespace separated uid=<UID>, ppid=<PID>, state=<LETTERS>, min_rss=<SIZE>,
+ *                     max_rss=<SIZE> and kthread=<0|1> items, evaluated by the module while it walks the task list.
+ *                     Sizes are in KB, or in bytes with a K, M or G suffix, e.g. "uid=1000 min_rss=1G".
+ *   -key <KEY>: With -top, the processes are ranked by KEY, which is rss (resident memory), vm (virtual memory size)
+ *               or cpu (user and system CPU time).
+ *   -netlink: With -pid, -pname, -pids or -pfile, every target is queried with its own generic netlink request
+ *             instead of through the /proc file. The requests are pipelined over one socket and the replies are
+ *             printed like -binary records.
+ *
+ * Daemon mode:
+ * - get_proc_info <app_path> --daemon loads the module once, keeps the /proc file open and answers the queries of
+ *   --client runs over a Unix domain socket until it is interrupted, then removes the module if it loaded it.
+ * - A client connection carries one query. The client sends the query and shuts its side down, and the daemon
+ *   answers with the output of the /proc file and closes the connection.
+ * 
+ * Please ensure the correct number of command line arguments is passed. It must work with only one parameter,
+ * and if both -pid and -pname information is given, it should give an error.
+ * 
+ * -pid is the equivalent of -upid in the kernel space, and -pname is the equivalent of -upname in the kernel space.
+ * 
+ * The flow:
+ * - Get the process ID or name argument from the terminal.
+ * - Insert the kernel object to the OS with finit_module unless the module is already loaded.
+ * - Write the query ("pid=<PID>", "name=<NAME>" or a batch of them) to the /proc file.
+ * - Read log messages to be written by the kernel module from the /proc file.
+ * - Print log messages in the terminal.
+ * - Remove the kernel module with delete_module if it was inserted by this run; a resident module is left loaded.
+ * - Exit the program with exit value 0.
+ * 
+ * If an error occurs in any of the above steps, print an appropriate error message and exit the program with exit value 1.
+ * 
+ * Authors:
+ * - [ Burak Keçeci - 290201103 ][ Berkan Gönülsever - 270201064 ]
+ * 
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+#include "proc_info_module.h"
+
+#define BUFFER_SIZE 256
+#define READ_SIZE 4096
+#define PROC_FILE "/proc/proc_info_module"
+#define MODULE_NAME "proc_info_module"
+#define SOCKET_PATH "/run/proc_info_module.sock"
+#define QUERY_MAX (16 * READ_SIZE)  // Longest query accepted by the module
+#define SAMPLES_FILE "/proc/proc_info_module_samples"
+#define EVENTS_FILE "/proc/proc_info_module_events"
+#define NETLINK_WINDOW 32  // Most netlink requests in flight at a time, so the replies fit in the socket buffer
+#define BINARY_HEADER "TIME_NS\tPID\tPPID\tUID\tSTATE\tRSS_KB\tANON_KB\tFILE_KB\tSHMEM_KB\tVM_KB\tDEPTH\tUTIME_MS\tSTIME_MS\tSTART_MS\tNVCSW\tNIVCSW\tRUN_DELAY_MS\tNAME\n"
+
+// Set by the SIGINT handler to stop reading samples
+static volatile sig_atomic_t interrupted = 0;
+
+/**
+ * Prints an error message to stderr and exits the program with a non-zero exit code.
+ * @param message The error message to be printed.
+ */
+void display_error(const char *message);
+
+/**
+ * Builds a batch query from a file listing one process ID or process name per line.
+ * Numeric lines become "pid=" items and every other non-empty line becomes a "name=" item.
+ * @param path The path of the target list file.
+ * @return The query, allocated with malloc.
+ */
+char *read_target_file(const char *path);
+
+/**
+ * Appends an item to a query.
+ * @param query The query, allocated with malloc.
+ * @param item The item to append, including its leading separator.
+ * @return The reallocated query.
+ */
+char *append_query(char *query, const char *item);
+
+/**
+ * Reads binary records from the /proc file until the end of the output and prints one line per record.
+ * Records older than PROC_INFO_RECORD_VERSION are skipped, newer ones are read up to the known fields.
+ * @param proc_fd The open /proc file in binary mode.
+ */
+void print_binary_records(int proc_fd);
+
+/**
+ * Reads binary event records from the events file until the application is interrupted and prints one line per event.
+ * Records older than PROC_INFO_EVENT_VERSION are skipped, newer ones are read up to the known fields.
+ * @param events_fd The open events file in binary mode.
+ */
+void print_event_records(int events_fd);
+
+/**
+ * Prints one binary record as a tab separated line, or an error line if its target was not found.
+ * @param record The record to print.
+ */
+void print_binary_record(const struct proc_info_bin_record *record);
+
+/**
+ * Reads the whole output of the /proc file from offset 0 with pread, so the same open file can be read repeatedly.
+ * @param proc_fd The open /proc file.
+ * @param buffer The buffer to read into, allocated with malloc and grown as needed.
+ * @param capacity The size of the buffer, updated when it grows.
+ * @return The number of bytes read.
+ */
+size_t read_output(int proc_fd, unsigned char **buffer, size_t *capacity);
+
+/**
+ * Orders binary records by process ID, for qsort and bsearch.
+ * @param lhs The first record.
+ * @param rhs The second record.
+ * @return A negative value, 0 or a positive value if the first process ID is lower, equal or higher.
+ */
+int compare_record_pid(const void *lhs, const void *rhs);
+
+/**
+ * Reads the binary records of the targets every interval and prints one line per record with the change of its
+ * memory usage and state since the previous sample, until the application is interrupted.
+ * @param proc_fd The open /proc file in binary mode.
+ * @param interval_ms The time between two samples.
+ */
+void watch_records(int proc_fd, long interval_ms);
+
+/**
+ * Maps the shared sample ring and prints its samples as they arrive until the application is interrupted.
+ * The samples are read from the mapping without a system call per sample.
+ * @param samples_fd The open samples /proc file.
+ * @param interval_ms The sampling interval, used as the pause between checks for new samples.
+ */
+void consume_shared_ring(int samples_fd, long interval_ms);
+
+/**
+ * Answers the targets of a query over the generic netlink family of the module instead of the /proc file.
+ * One request is sent per target and up to NETLINK_WINDOW requests are in flight on the socket at a time;
+ * the replies are matched to their targets by sequence number and printed like binary records.
+ * @param query The query, made of pid, name, pids, names and match=all items.
+ */
+void run_netlink_queries(const char *query);
+
+/**
+ * Sends one PROC_INFO_CMD_GET request for a process ID or process name.
+ * @param socket_fd The generic netlink socket.
+ * @param family_id The ID of the generic netlink family of the module.
+ * @param seq The sequence number of the request, echoed by its reply.
+ * @param target The process ID or process name.
+ * @param is_pid Whether the target is a process ID.
+ * @param all Whether every process with the name is reported instead of only the first one.
+ */
+void send_netlink_query(int socket_fd, __u16 family_id, __u32 seq, const char *target, int is_pid, int all);
+
+/**
+ * Looks the generic netlink family of the module up through the generic netlink controller.
+ * @param socket_fd The generic netlink socket.
+ * @return The family ID.
+ */
+__u16 resolve_netlink_family(int socket_fd);
+
+/**
+ * Appends an attribute to a netlink message, which must have room for it.
+ * @param msg The message.
+ * @param type The attribute type.
+ * @param data The payload of the attribute.
+ * @param len The size of the payload.
+ */
+void put_netlink_attr(struct nlmsghdr *msg, __u16 type, const void *data, size_t len);
+
+/**
+ * Checks that an attribute lies within the remaining bytes of its message.
+ * @param attr The attribute.
+ * @param rem The bytes remaining from the start of the attribute.
+ * @return 1 if the attribute is complete, 0 otherwise.
+ */
+int netlink_attr_ok(const struct nlattr *attr, int rem);
+
+/**
+ * Receives one datagram from a netlink socket, growing the buffer to fit it.
+ * @param socket_fd The netlink socket.
+ * @param buffer The buffer to receive into, allocated with malloc.
+ * @param capacity The size of the buffer, updated when it grows.
+ * @return The number of bytes received.
+ */
+int recv_netlink(int socket_fd, unsigned char **buffer, size_t *capacity);
+
+/**
+ * Prints the records of a PROC_INFO_CMD_RECORDS message, one tab separated line per process.
+ * @param msg The message.
+ */
+void print_netlink_records(const struct nlmsghdr *msg);
+
+/**
+ * Decodes the attributes nested in a PROC_INFO_ATTR_RECORD attribute into a binary record.
+ * @param nest The PROC_INFO_ATTR_RECORD attribute.
+ * @param record The record to fill.
+ */
+void decode_netlink_record(const struct nlattr *nest, struct proc_info_bin_record *record);
+
+/**
+ * Inserts the kernel module with the finit_module system call, without spawning a shell and insmod.
+ * @param path The path of the kernel object.
+ * @param params The module parameters, e.g. "upid=1", or an empty string.
+ */
+void load_module(const char *path, const char *params);
+
+/**
+ * Removes the kernel module with the delete_module system call, without spawning a shell and rmmod.
+ */
+void unload_module(void);
+
+/**
+ * Returns the time elapsed since a point in time.
+ * @param start The point in time, taken from CLOCK_MONOTONIC.
+ * @return The elapsed time in microseconds.
+ */
+double elapsed_us(const struct timespec *start);
+
+/**
+ * Loads the module unless it is resident and answers the queries of clients over the Unix domain socket until
+ * the application is interrupted.
+ * @param app_path The path of the kernel object.
+ */
+void run_daemon(const char *app_path);
+
+/**
+ * Answers one client connection of the daemon: reads the query, writes it to the /proc file and sends the output back.
+ * @param proc_fd The /proc file kept open by the daemon.
+ * @param client_fd The connected client socket.
+ */
+void serve_query(int proc_fd, int client_fd);
+
+/**
+ * Connects to the daemon socket.
+ * @return The connected socket.
+ */
+int connect_daemon(void);
+
+/**
+ * Writes a whole buffer to a socket, retrying after partial writes.
+ * @param fd The socket to write to.
+ * @param buffer The bytes to write.
+ * @param len The number of bytes to write.
+ * @return 0 on success, -1 on failure.
+ */
+int write_all(int fd, const void *buffer, size_t len);
+
+/**
+ * Marks the application as interrupted, so a blocked read of the samples returns.
+ * @param signum The received signal.
+ */
+void handle_interrupt(int signum);
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[2], "--daemon") == 0) {
+        run_daemon(argv[1]);
+        return 0;
+    }
+
+    // Check the number of command line arguments, -snapshot and -events are the argument types without a value
+    int snapshot = argc >= 3 && strcmp(argv[2], "-snapshot") == 0;
+    int events = argc >= 3 && strcmp(argv[2], "-events") == 0;
+    int no_value = snapshot || events;
+    if (argc < (no_value ? 3 : 4)) {
+        display_error("Invalid number of arguments. Usage: get_proc_info <app_path> "
+                      "<-pid|-pname|-pids|-pfile|-bench|-top|-tree|-threads> <value> | -snapshot | -events "
+                      "[-all] [-binary] [-interval <MS>] [-mmap] [-timing] [--client] [-watch <MS>] [-netlink] "
+                      "[-filter <FILTER>] [-key <KEY>], or get_proc_info <app_path> --daemon");
+    }
+
+    // Parse command line arguments
+    char *app_path = argv[1];
+    char *arg_type = argv[2];
+    char *arg_value = no_value ? "" : argv[3];
+
+    // Check if exactly one of the argument types is provided
+    if (strcmp(arg_type, "-pid") != 0 && strcmp(arg_type, "-pname") != 0 &&
+        strcmp(arg_type, "-pids") != 0 && strcmp(arg_type, "-pfile") != 0 &&
+        strcmp(arg_type, "-bench") != 0 && strcmp(arg_type, "-tree") != 0 &&
+        strcmp(arg_type, "-threads") != 0 && strcmp(arg_type, "-top") != 0 && !no_value) {
+        display_error("Invalid argument type. One of -pid, -pname, -pids, -pfile, -bench, -snapshot, -top, -tree, -threads or -events should be provided.");
+    }
+
+    // Create the query to write to the /proc file
+    char *query;
+    size_t query_size = strlen(arg_value) + BUFFER_SIZE;
+
+    if (strcmp(arg_type, "-pfile") == 0) {
+        query = read_target_file(arg_value);
+    } else {
+        query = malloc(query_size);
+        if (query == NULL) {
+            display_error("Failed to allocate the query.");
+        }
+
+        if (strcmp(arg_type, "-pid") == 0) {
+            snprintf(query, query_size, "pid=%s", arg_value);
+        } else if (strcmp(arg_type, "-pname") == 0) {
+            snprintf(query, query_size, "names=%s", arg_value);
+        } else if (strcmp(arg_type, "-pids") == 0) {
+            snprintf(query, query_size, "pids=%s", arg_value);
+        } else if (strcmp(arg_type, "-tree") == 0) {
+            snprintf(query, query_size, "tree=%s", arg_value);
+        } else if (strcmp(arg_type, "-threads") == 0) {
+            snprintf(query, query_size, "threads=%s", arg_value);
+        } else if (strcmp(arg_type, "-top") == 0) {
+            snprintf(query, query_size, "topn=%s", arg_value);
+        } else if (snapshot) {
+            snprintf(query, query_size, "mode=snapshot");
+        } else if (events) {
+            query[0] = '\0';
+        } else {
+            snprintf(query, query_size, "bench=%s", arg_value);
+        }
+    }
+
+    // Parse the optional flags after the value
+    int binary = 0;
+    int sampling = 0;
+    int shared = 0;
+    int timing = 0;
+    int client = 0;
+    int netlink = 0;
+    int all = 0;
+    long watch_ms = 0;
+    long interval_ms = 0;
+    for (int i = no_value ? 3 : 4; i < argc; i++) {
+        if (strcmp(argv[i], "-all") == 0) {
+            query = append_query(query, " match=all");
+            all = 1;
+        } else if (strcmp(argv[i], "-binary") == 0) {
+            query = append_query(query, " format=binary");
+            binary = 1;
+        } else if (strcmp(argv[i], "-interval") == 0 && i + 1 < argc) {
+            char item[BUFFER_SIZE];
+            interval_ms = atol(argv[++i]);
+            snprintf(item, BUFFER_SIZE, " interval=%s", argv[i]);
+            query = append_query(query, item);
+            sampling = 1;
+        } else if (strcmp(argv[i], "-mmap") == 0) {
+            query = append_query(query, " ring=shared");
+            shared = 1;
+        } else if (strcmp(argv[i], "-timing") == 0) {
+            timing = 1;
+        } else if (strcmp(argv[i], "--client") == 0) {
+            client = 1;
+        } else if (strcmp(argv[i], "-netlink") == 0) {
+            netlink = 1;
+        } else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc) {
+            query = append_query(query, " ");
+            query = append_query(query, argv[++i]);
+        } else if (strcmp(argv[i], "-key") == 0 && i + 1 < argc) {
+            char item[BUFFER_SIZE];
+            snprintf(item, BUFFER_SIZE, " key=%s", argv[++i]);
+            query = append_query(query, item);
+        } else if (strcmp(argv[i], "-watch") == 0 && i + 1 < argc) {
+            watch_ms = atol(argv[++i]);
+            if (watch_ms <= 0) {
+                display_error("-watch needs a positive interval in milliseconds.");
+            }
+        } else {
+            display_error("Invalid flag. Only -all, -binary, -interval <MS>, -mmap, -timing, --client, -watch <MS>, -netlink, -filter <FILTER> or -key <KEY> can follow the value.");
+        }
+    }
+    if (watch_ms && (sampling || client)) {
+        display_error("-watch reads the /proc file itself, it cannot be combined with -interval or --client.");
+    }
+    // Watching compares the binary records of consecutive reads
+    if (watch_ms && !binary) {
+        query = append_query(query, " format=binary");
+    }
+    if (shared && (!sampling || interval_ms <= 0)) {
+        display_error("-mmap needs a sampling interval given with -interval <MS>.");
+    }
+    if (client && sampling) {
+        display_error("The daemon does not sample, -interval cannot be combined with --client.");
+    }
+    if (netlink && (sampling || watch_ms || client)) {
+        display_error("-netlink sends the queries itself, it cannot be combined with -interval, -watch or --client.");
+    }
+    if (events && (all || sampling || shared || client || watch_ms || netlink)) {
+        display_error("Only -binary and -timing can follow -events.");
+    }
+
+    // Insert the kernel module only if it is not resident already
+    struct timespec start;
+    int inserted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!client && access(PROC_FILE, F_OK) != 0) {
+        load_module(app_path, "");
+        inserted = 1;
+    }
+    if (timing && !client) {
+        fprintf(stderr, "Timing: load %.1f us%s\n", elapsed_us(&start), inserted ? "" : " (already loaded)");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Samples, watches and events are read until Ctrl-C, which interrupts the blocked read or sleep instead of ending the application
+    if (sampling || watch_ms || events) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_interrupt;
+        sigaction(SIGINT, &action, NULL);
+    }
+
+    // Write the query and read log messages back from the same open /proc file, or from the daemon connection
+    int proc_fd = -1;
+    if (client) {
+        proc_fd = connect_daemon();
+        if (write_all(proc_fd, query, strlen(query)) < 0 || shutdown(proc_fd, SHUT_WR) < 0) {
+            display_error("Failed to send the query to the daemon.");
+        }
+    } else if (!netlink) {
+        proc_fd = open(sampling ? SAMPLES_FILE : events ? EVENTS_FILE : PROC_FILE, O_RDWR);
+        if (proc_fd < 0) {
+            display_error("Failed to open the /proc file.");
+        }
+        // The events file only takes the output format instead of a query
+        if (events) {
+            query[0] = '\0';
+            query = append_query(query, binary ? "format=binary" : "format=text");
+        }
+        if (write(proc_fd, query, strlen(query)) < 0) {
+            display_error("Failed to write the query to the /proc file.");
+        }
+    }
+
+    // The module streams the output, so any number of targets is read in fixed size chunks
+    if (netlink) {
+        run_netlink_queries(query);
+    } else if (shared) {
+        consume_shared_ring(proc_fd, interval_ms);
+    } else if (watch_ms) {
+        watch_records(proc_fd, watch_ms);
+    } else if (events && binary) {
+        print_event_records(proc_fd);
+    } else if (binary) {
+        print_binary_records(proc_fd);
+    } else {
+        char msg[READ_SIZE];
+        ssize_t bytes_read;
+        while ((bytes_read = read(proc_fd, msg, READ_SIZE)) > 0) {
+            fwrite(msg, 1, bytes_read, stdout);
+            fflush(stdout);
+        }
+        if (bytes_read < 0 && !interrupted) {
+            display_error("Failed to read the /proc file.");
+        }
+    }
+
+    // Stop the sampler so a resident module does not keep sampling
+    if (sampling && write(proc_fd, "interval=0", strlen("interval=0")) < 0) {
+        display_error("Failed to stop the sampler.");
+    }
+
+    free(query);
+    if (proc_fd >= 0) {
+        close(proc_fd);
+    }
+    if (timing) {
+        fprintf(stderr, "Timing: query %.1f us\n", elapsed_us(&start));
+    }
+
+    // Remove the kernel module if this run inserted it
+    if (inserted) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unload_module();
+        if (timing) {
+            fprintf(stderr, "Timing: unload %.1f us\n", elapsed_us(&start));
+        }
+    }
+
+    return 0;
+}
+
+void display_error(const char *message) {
+    fprintf(stderr, "Error: %s\n", message);
+    exit(1);
+}
+
+char *read_target_file(const char *path) {
+    FILE *target_file = fopen(path, "r");
+    if (target_file == NULL) {
+        display_error("Failed to open the target list file.");
+    }
+
+    size_t query_size = BUFFER_SIZE;
+    size_t query_len = 0;
+    char *query = malloc(query_size);
+    if (query == NULL) {
+        display_error("Failed to allocate the query.");
+    }
+    query[0] = '\0';
+
+    char line[BUFFER_SIZE];
+    while (fgets(line, BUFFER_SIZE, target_file) != NULL) {
+        char *target = line + strspn(line, " \t");
+        target[strcspn(target, " \t\r\n")] = '\0';
+        if (*target == '\0') {
+            continue;
+        }
+
+        // Grow the query to fit the item, its key and the separator
+        size_t item_size = strlen(target) + sizeof("name=\n");
+        if (query_len + item_size >= query_size) {
+            query_size = 2 * query_size + item_size;
+            query = realloc(query, query_size);
+            if (query == NULL) {
+                display_error("Failed to allocate the query.");
+            }
+        }
+
+        int numeric = strspn(target, "0123456789") == strlen(target);
+        query_len += snprintf(query + query_len, query_size - query_len, "%s=%s\n",
+                              numeric ? "pid" : "name", target);
+    }
+
+    fclose(target_file);
+    if (query_len == 0) {
+        display_error("The target list file does not list any process.");
+    }
+    return query;
+}
+
+char *append_query(char *query, const char *item) {
+    query = realloc(query, strlen(query) + strlen(item) + 1);
+    if (query == NULL) {
+        display_error("Failed to allocate the query.");
+    }
+    return strcat(query, item);
+}
+
+void print_binary_records(int proc_fd) {
+    unsigned char buffer[READ_SIZE];
+    size_t len = 0;
+    ssize_t bytes_read;
+
+    printf(BINARY_HEADER);
+
+    // A read may end in the middle of a record, so keep the remainder for the next read
+    while ((bytes_read = read(proc_fd, buffer + len, READ_SIZE - len)) > 0) {
+        size_t offset = 0;
+        len += bytes_read;
+
+        while (len - offset >= 2 * sizeof(__u16)) {
+            __u16 version, size;
+            memcpy(&version, buffer + offset, sizeof(version));
+            memcpy(&size, buffer + offset + sizeof(version), sizeof(size));
+            if (size < 2 * sizeof(__u16) || size > READ_SIZE) {
+                display_error("Corrupted binary record.");
+            }
+            if (len - offset < size) {
+                break;
+            }
+
+            if (version >= PROC_INFO_RECORD_VERSION && size >= sizeof(struct proc_info_bin_record)) {
+                struct proc_info_bin_record record;
+                memcpy(&record, buffer + offset, sizeof(record));
+                print_binary_record(&record);
+            }
+            offset += size;
+        }
+
+        memmove(buffer, buffer + offset, len - offset);
+        len -= offset;
+        fflush(stdout);
+    }
+    if (bytes_read < 0 && !interrupted) {
+        display_error("Failed to read the /proc file.");
+    }
+}
+
+void print_event_records(int events_fd) {
+    static const char *const names[] = {
+        [PROC_INFO_EVENT_FORK] = "fork",
+        [PROC_INFO_EVENT_EXEC] = "exec",
+        [PROC_INFO_EVENT_EXIT] = "exit",
+    };
+    struct proc_info_event_record record;
+    ssize_t bytes_read;
+
+    printf("TIME_NS\tEVENT\tPID\tPPID\tEXIT\tPEAK_RSS_KB\tNAME\n");
+
+    // The module only returns whole records, so every read holds a number of them
+    unsigned char buffer[READ_SIZE];
+    while ((bytes_read = read(events_fd, buffer, READ_SIZE)) > 0) {
+        for (size_t offset = 0; offset + 2 * sizeof(__u16) <= (size_t)bytes_read; ) {
+            __u16 version, size;
+            memcpy(&version, buffer + offset, sizeof(version));
+            memcpy(&size, buffer + offset + sizeof(version), sizeof(size));
+            if (size < 2 * sizeof(__u16) || offset + size > (size_t)bytes_read) {
+                display_error("Corrupted event record.");
+            }
+            if (version >= PROC_INFO_EVENT_VERSION && size >= sizeof(record)) {
+                memcpy(&record, buffer + offset, sizeof(record));
+                if (record.type == PROC_INFO_EVENT_LOST) {
+                    printf("Warning: %u events dropped, the reader fell behind.\n", record.lost);
+                } else if (record.type < sizeof(names) / sizeof(names[0]) && names[record.type] != NULL) {
+                    // The wait status holds the terminating signal in its low bits, or the exit status above them
+                    char status[BUFFER_SIZE] = "-";
+                    if (record.type == PROC_INFO_EVENT_EXIT && (record.exit_code & 0x7f)) {
+                        snprintf(status, BUFFER_SIZE, "SIG%d", record.exit_code & 0x7f);
+                    } else if (record.type == PROC_INFO_EVENT_EXIT) {
+                        snprintf(status, BUFFER_SIZE, "%d", (record.exit_code >> 8) & 0xff);
+                    }
+                    printf("%llu\t%s\t%d\t%d\t%s\t%llu\t%.*s\n", (unsigned long long)record.timestamp,
+                           names[record.type], record.pid, record.ppid, status,
+                           (unsigned long long)record.peak_rss, PROC_INFO_COMM_LEN, record.comm);
+                }
+            }
+            offset += size;
+        }
+        fflush(stdout);
+    }
+    if (bytes_read < 0 && !interrupted) {
+        display_error("Failed to read the events file.");
+    }
+}
+
+void print_binary_record(const struct proc_info_bin_record *record) {
+    if (record->flags & PROC_INFO_RECORD_FOUND) {
+        printf("%llu\t%d\t%d\t%u\t%c\t%llu\t%llu\t%llu\t%llu\t%llu\t%u\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%.*s\n",
+               (unsigned long long)record->timestamp, record->pid, record->ppid, record->uid, record->state_char,
+               (unsigned long long)record->memory_usage, (unsigned long long)record->rss_anon,
+               (unsigned long long)record->rss_file, (unsigned long long)record->rss_shmem,
+               (unsigned long long)record->vm_size, record->depth,
+               (unsigned long long)record->utime / 1000000, (unsigned long long)record->stime / 1000000,
+               (unsigned long long)record->start_time / 1000000, (unsigned long long)record->nvcsw,
+               (unsigned long long)record->nivcsw, (unsigned long long)record->run_delay / 1000000,
+               PROC_INFO_COMM_LEN, record->comm);
+    } else if (record->comm[0] != '\0') {
+        printf("Error: Process with name %.*s not found.\n", PROC_INFO_COMM_LEN, record->comm);
+    } else {
+        printf("Error: Process with ID %d not found.\n", record->pid);
+    }
+}
+
+size_t read_output(int proc_fd, unsigned char **buffer, size_t *capacity) {
+    size_t len = 0;
+    ssize_t bytes_read;
+
+    // A read at offset 0 makes the module take the records again
+    while ((bytes_read = pread(proc_fd, *buffer + len, *capacity - len, len)) > 0) {
+        len += bytes_read;
+        if (len == *capacity) {
+            *capacity *= 2;
+            *buffer = realloc(*buffer, *capacity);
+            if (*buffer == NULL) {
+                display_error("Failed to allocate the output buffer.");
+            }
+        }
+    }
+    if (bytes_read < 0 && !interrupted) {
+        display_error("Failed to read the /proc file.");
+    }
+    return len;
+}
+
+int compare_record_pid(const void *lhs, const void *rhs) {
+    const struct proc_info_bin_record *l = lhs, *r = rhs;
+    return (l->pid > r->pid) - (l->pid < r->pid);
+}
+
+void watch_records(int proc_fd, long interval_ms) {
+    size_t capacity = READ_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    struct proc_info_bin_record *previous = NULL;
+    size_t nr_previous = 0;
+    if (buffer == NULL) {
+        display_error("Failed to allocate the output buffer.");
+    }
+
+    struct timespec start;
+    struct timespec pause = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("TIME_S\tPID\tNAME\tSTATE\tRSS_KB\tRSS_DELTA_KB\tVM_KB\tVM_DELTA_KB\tCPU_PCT\n");
+
+    while (!interrupted) {
+        size_t len = read_output(proc_fd, &buffer, &capacity);
+        size_t nr_records = 0;
+        struct proc_info_bin_record *records = malloc(len + sizeof(*records));
+        if (records == NULL) {
+            display_error("Failed to allocate the records.");
+        }
+
+        for (size_t offset = 0; offset + 2 * sizeof(__u16) <= len; ) {
+            __u16 version, size;
+            memcpy(&version, buffer + offset, sizeof(version));
+            memcpy(&size, buffer + offset + sizeof(version), sizeof(size));
+            if (size < 2 * sizeof(__u16) || offset + size > len) {
+                display_error("Corrupted binary record.");
+            }
+            if (version >= PROC_INFO_RECORD_VERSION && size >= sizeof(struct proc_info_bin_record)) {
+                memcpy(&records[nr_records++], buffer + offset, sizeof(*records));
+            }
+            offset += size;
+        }
+
+        double now = elapsed_us(&start) / 1e6;
+        for (size_t i = 0; i < nr_records; i++) {
+            const struct proc_info_bin_record *record = &records[i];
+            if (!(record->flags & PROC_INFO_RECORD_FOUND)) {
+                print_binary_record(record);
+                continue;
+            }
+
+            // Deltas are taken against the previous sample of the same process, new processes start from 0
+            const struct proc_info_bin_record *last = NULL;
+            if (nr_previous > 0) {
+                last = bsearch(record, previous, nr_previous, sizeof(*previous), compare_record_pid);
+            }
+            if (last && !(last->flags & PROC_INFO_RECORD_FOUND)) {
+                last = NULL;
+            }
+            long long rss_delta = last ? (long long)record->memory_usage - (long long)last->memory_usage : 0;
+            long long vm_delta = last ? (long long)record->vm_size - (long long)last->vm_size : 0;
+
+            // CPU usage is the CPU time the process gained over the time between the two records
+            double cpu_pct = 0;
+            if (last && record->timestamp > last->timestamp) {
+                double cpu_ns = (double)(record->utime + record->stime) - (double)(last->utime + last->stime);
+                cpu_pct = 100.0 * cpu_ns / (double)(record->timestamp - last->timestamp);
+            }
+
+            printf("%.3f\t%d\t%.*s\t%c\t%llu\t%+lld\t%llu\t%+lld\t%.1f", now, record->pid, PROC_INFO_COMM_LEN,
+                   record->comm, record->state_char, (unsigned long long)record->memory_usage, rss_delta,
+                   (unsigned long long)record->vm_size, vm_delta, cpu_pct);
+            if (last && last->state_char != record->state_char) {
+                printf("\tstate %c -> %c", last->state_char, record->state_char);
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+
+        // The records are kept sorted by process ID, so the next sample finds each process in O(log n)
+        qsort(records, nr_records, sizeof(*records), compare_record_pid);
+        free(previous);
+        previous = records;
+        nr_previous = nr_records;
+        nanosleep(&pause, NULL);
+    }
+
+    free(previous);
+    free(buffer);
+}
+
+void consume_shared_ring(int samples_fd, long interval_ms) {
+    // The header tells the size of the whole mapping
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct proc_info_ring_header *header = mmap(NULL, page_size, PROT_READ, MAP_SHARED, samples_fd, 0);
+    if (header == MAP_FAILED) {
+        display_error("Failed to map the shared sample ring.");
+    }
+    if (header->version != PROC_INFO_RING_VERSION || header->record_size < sizeof(struct proc_info_bin_record)) {
+        display_error("Unsupported shared sample ring.");
+    }
+    size_t map_size = header->data_offset + (size_t)header->nr_slots * header->record_size;
+    munmap(header, page_size);
+
+    header = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, samples_fd, 0);
+    if (header == MAP_FAILED) {
+        display_error("Failed to map the shared sample ring.");
+    }
+    const unsigned char *slots = (const unsigned char *)header + header->data_offset;
+
+    printf(BINARY_HEADER);
+
+    // Samples are consumed straight from the mapping, the only system call is the sleep between batches
+    struct timespec pause = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    __u32 tail = header->tail;
+    while (!interrupted) {
+        __u32 head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            struct proc_info_bin_record record;
+            memcpy(&record, slots + (size_t)(tail & (header->nr_slots - 1)) * header->record_size, sizeof(record));
+            if (record.version >= PROC_INFO_RECORD_VERSION && record.size >= sizeof(record)) {
+                print_binary_record(&record);
+            }
+            tail++;
+            __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+        }
+        fflush(stdout);
+        nanosleep(&pause, NULL);
+    }
+
+    if (header->dropped) {
+        fprintf(stderr, "Warning: %llu samples dropped, the shared ring was full.\n",
+                (unsigned long long)header->dropped);
+    }
+    munmap(header, map_size);
+}
+
+void run_netlink_queries(const char *query) {
+    char *items = strdup(query);
+    if (items == NULL) {
+        display_error("Failed to allocate the query.");
+    }
+
+    // Split the query into its targets, the values point into the copy
+    struct { const char *value; int is_pid; } *targets = NULL;
+    size_t nr_targets = 0;
+    int all = 0;
+    char *item_state;
+    for (char *item = strtok_r(items, " \t\n", &item_state); item != NULL; item = strtok_r(NULL, " \t\n", &item_state)) {
+        char *value = strchr(item, '=');
+        if (value == NULL) {
+            display_error("Invalid query.");
+        }
+        *value++ = '\0';
+
+        if (strcmp(item, "match") == 0 && strcmp(value, "all") == 0) {
+            all = 1;
+            continue;
+        }
+        // The replies are always decoded into binary records
+        if (strcmp(item, "format") == 0 && strcmp(value, "binary") == 0) {
+            continue;
+        }
+        int is_pid = strcmp(item, "pid") == 0 || strcmp(item, "pids") == 0;
+        if (!is_pid && strcmp(item, "name") != 0 && strcmp(item, "names") != 0) {
+            display_error("Only -pid, -pname, -pids and -pfile queries can be sent over netlink.");
+        }
+
+        char *value_state;
+        for (char *target = strtok_r(value, ",", &value_state); target != NULL; target = strtok_r(NULL, ",", &value_state)) {
+            if (is_pid && strspn(target, "0123456789") != strlen(target)) {
+                display_error("Invalid process ID.");
+            }
+            if (!is_pid && strlen(target) >= PROC_INFO_COMM_LEN) {
+                display_error("Process names are limited to 15 characters.");
+            }
+            targets = realloc(targets, (nr_targets + 1) * sizeof(*targets));
+            if (targets == NULL) {
+                display_error("Failed to allocate the targets.");
+            }
+            targets[nr_targets].value = target;
+            targets[nr_targets].is_pid = is_pid;
+            nr_targets++;
+        }
+    }
+
+    int socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (socket_fd < 0) {
+        display_error("Failed to create the netlink socket.");
+    }
+    __u16 family_id = resolve_netlink_family(socket_fd);
+
+    size_t capacity = READ_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        display_error("Failed to allocate the reply buffer.");
+    }
+
+    printf(BINARY_HEADER);
+
+    // Requests are sent ahead of the replies, the module answers them in order with their sequence numbers
+    size_t sent = 0;
+    size_t answered = 0;
+    while (answered < nr_targets) {
+        while (sent < nr_targets && sent - answered < NETLINK_WINDOW) {
+            send_netlink_query(socket_fd, family_id, sent + 1, targets[sent].value, targets[sent].is_pid, all);
+            sent++;
+        }
+
+        int len = recv_netlink(socket_fd, &buffer, &capacity);
+        for (struct nlmsghdr *msg = (struct nlmsghdr *)buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_seq == 0 || msg->nlmsg_seq > sent) {
+                continue;
+            }
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *error = NLMSG_DATA(msg);
+                printf("Error: Query for %s failed: %s.\n", targets[msg->nlmsg_seq - 1].value, strerror(-error->error));
+                answered++;
+            } else if (msg->nlmsg_type == family_id) {
+                print_netlink_records(msg);
+                answered++;
+            }
+        }
+        fflush(stdout);
+    }
+
+    close(socket_fd);
+    free(buffer);
+    free(targets);
+    free(items);
+}
+
+void send_netlink_query(int socket_fd, __u16 family_id, __u32 seq, const char *target, int is_pid, int all) {
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        unsigned char attrs[2 * NLA_HDRLEN + NLA_ALIGN(PROC_INFO_COMM_LEN)];
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = family_id;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = seq;
+    request.genl.cmd = PROC_INFO_CMD_GET;
+    request.genl.version = PROC_INFO_GENL_VERSION;
+
+    if (is_pid) {
+        __s32 pid = atoi(target);
+        put_netlink_attr(&request.header, PROC_INFO_ATTR_PID, &pid, sizeof(pid));
+    } else {
+        put_netlink_attr(&request.header, PROC_INFO_ATTR_NAME, target, strlen(target) + 1);
+    }
+    if (all) {
+        put_netlink_attr(&request.header, PROC_INFO_ATTR_ALL, NULL, 0);
+    }
+
+    if (send(socket_fd, &request, request.header.nlmsg_len, 0) < 0) {
+        display_error("Failed to send the netlink request.");
+    }
+}
+
+__u16 resolve_netlink_family(int socket_fd) {
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        unsigned char attrs[NLA_HDRLEN + NLA_ALIGN(sizeof(PROC_INFO_GENL_NAME))];
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.genl.cmd = CTRL_CMD_GETFAMILY;
+    request.genl.version = 1;
+    put_netlink_attr(&request.header, CTRL_ATTR_FAMILY_NAME, PROC_INFO_GENL_NAME, sizeof(PROC_INFO_GENL_NAME));
+    if (send(socket_fd, &request, request.header.nlmsg_len, 0) < 0) {
+        display_error("Failed to send the netlink request.");
+    }
+
+    size_t capacity = READ_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        display_error("Failed to allocate the reply buffer.");
+    }
+    int len = recv_netlink(socket_fd, &buffer, &capacity);
+
+    __u16 family_id = 0;
+    const struct nlmsghdr *msg = (const struct nlmsghdr *)buffer;
+    if (NLMSG_OK(msg, len) && msg->nlmsg_type == GENL_ID_CTRL) {
+        const struct nlattr *attr = (const struct nlattr *)((const unsigned char *)NLMSG_DATA(msg) + GENL_HDRLEN);
+        int rem = msg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        for (; netlink_attr_ok(attr, rem);
+             rem -= NLA_ALIGN(attr->nla_len), attr = (const struct nlattr *)((const unsigned char *)attr + NLA_ALIGN(attr->nla_len))) {
+            if ((attr->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID && attr->nla_len >= NLA_HDRLEN + sizeof(__u16)) {
+                memcpy(&family_id, (const unsigned char *)attr + NLA_HDRLEN, sizeof(family_id));
+            }
+        }
+    }
+    free(buffer);
+
+    if (family_id == 0) {
+        display_error("The module does not provide the " PROC_INFO_GENL_NAME " netlink family.");
+    }
+    return family_id;
+}
+
+void put_netlink_attr(struct nlmsghdr *msg, __u16 type, const void *data, size_t len) {
+    struct nlattr *attr = (struct nlattr *)((unsigned char *)msg + NLMSG_ALIGN(msg->nlmsg_len));
+    attr->nla_type = type;
+    attr->nla_len = NLA_HDRLEN + len;
+    if (len > 0) {
+        memcpy((unsigned char *)attr + NLA_HDRLEN, data, len);
+    }
+    msg->nlmsg_len = NLMSG_ALIGN(msg->nlmsg_len) + NLA_ALIGN(attr->nla_len);
+}
+
+int netlink_attr_ok(const struct nlattr *attr, int rem) {
+    return rem >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= rem;
+}
+
+int recv_netlink(int socket_fd, unsigned char **buffer, size_t *capacity) {
+    // Peek at the size first, a datagram that does not fit the buffer would be truncated
+    ssize_t len = recv(socket_fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (len < 0) {
+        display_error(errno == ENOBUFS ? "Netlink replies were lost, the socket buffer is full." :
+                                         "Failed to receive the netlink reply.");
+    }
+    if ((size_t)len > *capacity) {
+        *capacity = len;
+        *buffer = realloc(*buffer, *capacity);
+        if (*buffer == NULL) {
+            display_error("Failed to allocate the reply buffer.");
+        }
+    }
+
+    len = recv(socket_fd, *buffer, *capacity, 0);
+    if (len < 0) {
+        display_error("Failed to receive the netlink reply.");
+    }
+    return (int)len;
+}
+
+void print_netlink_records(const struct nlmsghdr *msg) {
+    const struct nlattr *attr = (const struct nlattr *)((const unsigned char *)NLMSG_DATA(msg) + GENL_HDRLEN);
+    int rem = msg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    for (; netlink_attr_ok(attr, rem);
+         rem -= NLA_ALIGN(attr->nla_len), attr = (const struct nlattr *)((const unsigned char *)attr + NLA_ALIGN(attr->nla_len))) {
+        if ((attr->nla_type & NLA_TYPE_MASK) == PROC_INFO_ATTR_RECORD) {
+            struct proc_info_bin_record record;
+            decode_netlink_record(attr, &record);
+            print_binary_record(&record);
+        }
+    }
+}
+
+void decode_netlink_record(const struct nlattr *nest, struct proc_info_bin_record *record) {
+    memset(record, 0, sizeof(*record));
+    record->version = PROC_INFO_RECORD_VERSION;
+    record->size = sizeof(*record);
+
+    const struct nlattr *attr = (const struct nlattr *)((const unsigned char *)nest + NLA_HDRLEN);
+    int rem = nest->nla_len - NLA_HDRLEN;
+    for (; netlink_attr_ok(attr, rem);
+         rem -= NLA_ALIGN(attr->nla_len), attr = (const struct nlattr *)((const unsigned char *)attr + NLA_ALIGN(attr->nla_len))) {
+        const unsigned char *data = (const unsigned char *)attr + NLA_HDRLEN;
+        size_t len = attr->nla_len - NLA_HDRLEN;
+        void *field = NULL;
+        size_t size = 0;
+
+        switch (attr->nla_type & NLA_TYPE_MASK) {
+        case PROC_INFO_ATTR_FOUND: record->flags |= PROC_INFO_RECORD_FOUND; break;
+        case PROC_INFO_ATTR_HAS_MM: record->flags |= PROC_INFO_RECORD_HAS_MM; break;
+        case PROC_INFO_ATTR_PID: field = &record->pid; size = sizeof(record->pid); break;
+        case PROC_INFO_ATTR_NAME: field = record->comm; size = PROC_INFO_COMM_LEN - 1; break;
+        case PROC_INFO_ATTR_PPID: field = &record->ppid; size = sizeof(record->ppid); break;
+        case PROC_INFO_ATTR_UID: field = &record->uid; size = sizeof(record->uid); break;
+        case PROC_INFO_ATTR_STATE: field = &record->state; size = sizeof(record->state); break;
+        case PROC_INFO_ATTR_STATE_CHAR: field = &record->state_char; size = sizeof(record->state_char); break;
+        case PROC_INFO_ATTR_RSS: field = &record->memory_usage; size = sizeof(record->memory_usage); break;
+        case PROC_INFO_ATTR_RSS_ANON: field = &record->rss_anon; size = sizeof(record->rss_anon); break;
+        case PROC_INFO_ATTR_RSS_FILE: field = &record->rss_file; size = sizeof(record->rss_file); break;
+        case PROC_INFO_ATTR_RSS_SHMEM: field = &record->rss_shmem; size = sizeof(record->rss_shmem); break;
+        case PROC_INFO_ATTR_VM_SIZE: field = &record->vm_size; size = sizeof(record->vm_size); break;
+        case PROC_INFO_ATTR_TIMESTAMP: field = &record->timestamp; size = sizeof(record->timestamp); break;
+        case PROC_INFO_ATTR_UTIME: field = &record->utime; size = sizeof(record->utime); break;
+        case PROC_INFO_ATTR_STIME: field = &record->stime; size = sizeof(record->stime); break;
+        case PROC_INFO_ATTR_START_TIME: field = &record->start_time; size = sizeof(record->start_time); break;
+        case PROC_INFO_ATTR_NVCSW: field = &record->nvcsw; size = sizeof(record->nvcsw); break;
+        case PROC_INFO_ATTR_NIVCSW: field = &record->nivcsw; size = sizeof(record->nivcsw); break;
+        case PROC_INFO_ATTR_RUN_DELAY: field = &record->run_delay; size = sizeof(record->run_delay); break;
+        case PROC_INFO_ATTR_PATTERN: field = &record->pattern; size = sizeof(record->pattern); break;
+        }
+
+        // Unknown attributes from newer modules are skipped, short ones leave the field 0
+        if (field != NULL) {
+            memcpy(field, data, len < size ? len : size);
+        }
+    }
+}
+
+void load_module(const char *path, const char *params) {
+    int module_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (module_fd < 0) {
+        display_error("Failed to open the kernel object.");
+    }
+    if (syscall(SYS_finit_module, module_fd, params, 0) != 0) {
+        display_error("Failed to insert the kernel module.");
+    }
+    close(module_fd);
+}
+
+void unload_module(void) {
+    if (syscall(SYS_delete_module, MODULE_NAME, O_NONBLOCK) != 0) {
+        display_error("Failed to remove the kernel module.");
+    }
+}
+
+double elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+void run_daemon(const char *app_path) {
+    int inserted = 0;
+    if (access(PROC_FILE, F_OK) != 0) {
+        load_module(app_path, "");
+        inserted = 1;
+    }
+
+    // The /proc file stays open for the lifetime of the daemon, every query retargets it
+    int proc_fd = open(PROC_FILE, O_RDWR);
+    if (proc_fd < 0) {
+        display_error("Failed to open the /proc file.");
+    }
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd < 0) {
+        display_error("Failed to create the daemon socket.");
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SOCKET_PATH, sizeof(address.sun_path) - 1);
+    unlink(SOCKET_PATH);
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server_fd, SOMAXCONN) < 0) {
+        display_error("Failed to listen on the daemon socket.");
+    }
+    // Anyone may query, like the /proc file itself
+    chmod(SOCKET_PATH, 0666);
+
+    // Ctrl-C or SIGTERM interrupts the blocked accept instead of ending the daemon, so it can clean up
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_interrupt;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Serving queries on %s\n", SOCKET_PATH);
+    while (!interrupted) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd < 0) {
+            continue;
+        }
+        serve_query(proc_fd, client_fd);
+        close(client_fd);
+    }
+
+    close(server_fd);
+    unlink(SOCKET_PATH);
+    close(proc_fd);
+    if (inserted) {
+        unload_module();
+    }
+}
+
+void serve_query(int proc_fd, int client_fd) {
+    // A client that stops sending or stops reading must not stall the other clients
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char *query = malloc(QUERY_MAX);
+    if (query == NULL) {
+        return;
+    }
+    size_t len = 0;
+    ssize_t bytes_read;
+    while (len < QUERY_MAX && (bytes_read = read(client_fd, query + len, QUERY_MAX - len)) > 0) {
+        len += bytes_read;
+    }
+
+    // The module parses a query from a single write
+    if (len == 0 || len == QUERY_MAX || write(proc_fd, query, len) < 0) {
+        const char *error = "Error: Invalid query.\n";
+        write_all(client_fd, error, strlen(error));
+        free(query);
+        return;
+    }
+    free(query);
+
+    char msg[READ_SIZE];
+    while ((bytes_read = read(proc_fd, msg, READ_SIZE)) > 0) {
+        if (write_all(client_fd, msg, bytes_read) < 0) {
+            break;
+        }
+    }
+}
+
+int connect_daemon(void) {
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) {
+        display_error("Failed to create the client socket.");
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SOCKET_PATH, sizeof(address.sun_path) - 1);
+    if (connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        display_error("Failed to connect to the daemon. Start it with --daemon.");
+    }
+    return socket_fd;
+}
+
+int write_all(int fd, const void *buffer, size_t len) {
+    const char *bytes = buffer;
+    while (len > 0) {
+        // A client that went away must not end the daemon with SIGPIPE
+        ssize_t written = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (written < 0) {
+            return -1;
+        }
+        bytes += written;
+        len -= written;
+    }
+    return 0;
+}
+
+void handle_interrupt(int signum) {
+    (void)signum;
+    interrupted = 1;
+}
@@ -1,311 +1,3899 @@
-/*
- * Dynamic Kernel Module - proc_info_module.c
- *
- * This kernel module provides process information based on the given process ID (PID) or process name.
- * It creates a /proc file named proc_info_module that can be accessed from user space to retrieve process information.
- *
- * Module Parameters:
- *  - upid: A non-negative integer that specifies the user process ID (PID).
- *  - upname: A string that specifies the user process name.
- *
- * Process Information:
- *  - Name: Process name.
- *  - PID: Process ID.
- *  - PPID: PID of the process's parent.
- *  - UID: User identifier (UID) of the process.
- *  - Path: The path of the process in /proc.
- *  - State: The process state, such as running, interruptible, uninterruptible, or stopped.
- *  - Memory Usage: Memory usage of the process in kilobytes (KB). This information is only available when the process is in a running state.
- *
- * Flow:
- *  - Acquire process ID or name as module parameters.
- *  - Open the /proc file named proc_info_module.
- *  - If no processes with the specified ID or name are found, print an error message, log the error in the /proc file, and exit the program with exit value 2.
- *  - Obtain information about the process.
- *  - If the process is in a running state, calculate the memory usage.
- *  - When the /proc file is read from the user space application, log the message to the /proc file.
- *  - Exit the program with exit value 0.
- *
- * /proc file will be automatically removed when the kernel module is unloaded.
- * If an error occurs during any of the steps, an appropriate error message will be printed, logged in the /proc file, and the program will exit with exit value 1.
- *
- * Authors:
- * - [ Burak Keçeci - 290201103 ][ Berkan Gönülsever - 270201064 ]
- *
- * License: GPL
- */
-
-#include <linux/module.h> // Needed by all modules
-#include <linux/kernel.h> // Needed for KERN_INFO
-#include <linux/proc_fs.h> // Needed for the proc file system
-#include <linux/sched.h> // Needed for for_each_process macro
-#include <linux/slab.h> // Needed for kmalloc
-#include <linux/uaccess.h> // Needed for copy_to_user
-
-#define PROC_FILENAME "proc_info_module"
-
-static struct proc_dir_entry *proc_file_entry;
-
-static int upid = -1;  // User process ID
-static char upname[TASK_COMM_LEN] = {0};  // User process name
-
-
-
-/**
- * Convert the process state to string.
- * 
- * @state: The process state.
-*/
-static const char* get_state_string(long state);
-
-/**
- * Check if the task matches the provided process ID or process name.
- *
- * This function compares the process ID or process name of the given task with the provided
- * process ID or process name.
- *
- * @task: Pointer to the task structure to check.
- * @found_task: Pointer to the task structure pointer to store the matched task (if found).
- *
- * @return: 0 if the task matches the provided process ID or process name, 1 otherwise.
- */
-static int get_process_info(struct task_struct *task, struct task_struct **found_task);
-
-/**
- * Read callback function for the /proc file.
- *
- * This function is called when the /proc file is read. It retrieves information about the
- * specified process ID or process name and writes it to the user buffer.
- *
- * @file: Pointer to the file structure.
- * @buffer: User buffer to write the process information to.
- * @count: Size of the user buffer.
- * @offset: Pointer to the file offset.
- *
- * @return: Number of bytes written to the user buffer, or a negative error code on failure.
- */
-static ssize_t read_proc(struct file *file, char __user *buffer, size_t count, loff_t *offset);
-
-/**
- * Initialization function for the module.
- *
- * This function is called when the module is loaded into the kernel. It creates the /proc file
- * entry and registers the read callback function.
- *
- * @return: 0 on success, or a negative error code on failure.
- */
-static int proc_info_module_init(void);
-
-/**
- * Cleanup function for the module.
- *
- * This function is called when the module is unloaded from the kernel. It removes the /proc file
- * entry.
- */
-static void proc_info_module_exit(void);
-
-// File operations structure for the /proc file
-static const struct proc_ops proc_fops = {
-    .proc_read = read_proc,
-};
-
-/**
- * Convert the process state to string.
- * 
- * @state: The process state.
-*/
-static const char* get_state_string(long state) {
-    switch (state) {
-        case TASK_RUNNING: // state 0
-            return "Running";
-        case TASK_INTERRUPTIBLE:
-            return "Interruptible Sleep"; // state 1
-        case TASK_UNINTERRUPTIBLE:
-            return "Uninterruptible Sleep"; // state 2
-        case __TASK_STOPPED:
-            return "Stopped"; // state 4
-        case __TASK_TRACED:
-            return "Traced"; //  state 8
-        case EXIT_ZOMBIE:
-            return "Zombie"; // state 16
-        case EXIT_DEAD:
-            return "Dead (Exit)"; // state 32
-        case TASK_DEAD:
-            return "Dead"; // state 64
-        case TASK_WAKEKILL:
-            return "Wakekill"; // state 128
-        case TASK_WAKING:
-            return "Waking"; // state 256
-        case TASK_STATE_MAX:
-            return "State Max"; // state 512
-        default:
-            return "Unknown"; // state -1
-    }
-}
-
-/**
- * Check if the task matches the provided process ID or process name.
- *
- * This function compares the process ID or process name of the given task with the provided
- * process ID or process name.
- *
- * @task: Pointer to the task structure to check.
- * @found_task: Pointer to the task structure pointer to store the matched task (if found).
- *
- * @return: 0 if the task matches the provided process ID or process name, 1 otherwise.
- */
-static int get_process_info(struct task_struct *task, struct task_struct **found_task)
-{
-    if (upid != -1) {
-        if (task->pid == upid) {
-            *found_task = task;
-            return 0;
-        }
-    } else {
-        if (strcmp(task->comm, upname) == 0) {
-            *found_task = task;
-            return 0;
-        }
-    }
-    return 1;
-}
-
-/**
- * Log the information of a process to the buffer.
- *
- * This function retrieves information about a process and appends it to the given buffer.
- *
- * @task: Pointer to the task structure of the process.
- * @buffer: Pointer to the buffer to store the process information.
- * @size: Size of the buffer.
- */
-static void log_process_info(struct task_struct *task, char *buffer, size_t size)
-{
-    struct task_struct *parent_task = task->parent;
-    unsigned long memory_usage = 0;
-
-    if (task->mm && task->mm->total_vm)
-        memory_usage = task->mm->total_vm << (PAGE_SHIFT - 10);
-
-    sprintf(buffer + strlen(buffer), "Name: %s\n", task->comm);
-    sprintf(buffer + strlen(buffer), "PID: %d\n", task->pid);
-    sprintf(buffer + strlen(buffer), "PPID: %d\n", parent_task ? parent_task->pid : -1);
-    sprintf(buffer + strlen(buffer), "UID: %d\n", task_uid(task).val);
-    sprintf(buffer + strlen(buffer), "Path: /proc/%d\n", task->pid);
-    sprintf(buffer + strlen(buffer), "State: %s\n", get_state_string(task->__state));
-    if (task->__state == TASK_RUNNING) {
-        sprintf(buffer + strlen(buffer), "Memory usage: %lu KB\n", memory_usage);
-    } else {
-        sprintf(buffer + strlen(buffer), "Memory usage: State is not running.\n");
-    }
-}
-
-/**
- * Read callback function for the /proc file.
- *
- * This function is called when the /proc file is read. It retrieves information about the
- * specified process ID or process name and writes it to the user buffer.
- *
- * @file: Pointer to the file structure.
- * @buffer: User buffer to write the process information to.
- * @count: Size of the user buffer.
- * @offset: Pointer to the file offset.
- *
- * @return: Number of bytes written to the user buffer, or a negative error code on failure.
- */
-static ssize_t read_proc(struct file *file, char __user *buffer, size_t count, loff_t *offset)
-{
-    struct task_struct *task = NULL;
-    char *kbuffer;
-    size_t kbuffer_size;
-    ssize_t retval = 0;
-    int found_process = 0;
-
-    kbuffer_size = PAGE_SIZE;
-    kbuffer = kmalloc(kbuffer_size, GFP_KERNEL);
-    if (!kbuffer)
-        return -ENOMEM;
-
-    kbuffer[0] = '\0';
-
-    if (*offset == 0) {
-        rcu_read_lock();
-        for_each_process(task) {
-            if (get_process_info(task, &task) == 0) {
-                log_process_info(task, kbuffer, kbuffer_size);
-                found_process = 1;
-                break;
-            }
-        }
-        rcu_read_unlock();
-
-        if (!found_process) {
-            if (upid != -1)
-                sprintf(kbuffer, "Error: Process with ID %d not found.\n", upid);
-            else
-                sprintf(kbuffer, "Error: Process with name %s not found.\n", upname);
-            retval = -ENOENT;
-        }
-    }
-
-    retval = strlen(kbuffer);
-    if (copy_to_user(buffer, kbuffer, retval)) {
-        kfree(kbuffer);
-        return -EFAULT;
-    }
-
-    kfree(kbuffer);
-    *offset += retval;
-    return retval;
-}
-
-/**
- * Initialization function for the module.
- *
- * This function is called when the module is loaded into the kernel. It creates the /proc file
- * entry and registers the read callback function.
- *
- * @return: 0 on success, or a negative error code on failure.
- */
-static int proc_info_module_init(void)
-{
-    proc_file_entry = proc_create(PROC_FILENAME, 0, NULL, &proc_fops);
-    if (!proc_file_entry) {
-        printk(KERN_ERR "Failed to create /proc/%s entry\n", PROC_FILENAME);
-        return -ENOMEM;
-    }
-
-    printk(KERN_INFO "proc_info_module loaded\n");
-    return 0;
-}
-
-/**
- * Cleanup function for the module.
- *
- * This function is called when the module is unloaded from the kernel. It removes the /proc file
- * entry.
- */
-static void proc_info_module_exit(void)
-{
-    remove_proc_entry(PROC_FILENAME, NULL);
-    printk(KERN_INFO "proc_info_module unloaded\n");
-}
-
-// Module initialization and cleanup macros
-module_init(proc_info_module_init);
-module_exit(proc_info_module_exit);
-
-// Module parameters and their descriptions
-module_param(upid, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-MODULE_PARM_DESC(upid, "User process ID");
-
-module_param_string(upname, upname, TASK_COMM_LEN, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-MODULE_PARM_DESC(upname, "User process name");
-
-MODULE_LICENSE("GPL");
-MODULE_DESCRIPTION("Dynamic Kernel Module");
-MODULE_AUTHOR("Burak Keçeci & Berkan Gönülsever");
-
-
-
-
+/*
+ * Dynamic Kernel Module - proc_info_module.c
+ *
+ * This kernel module provides process information based on the given process ID (PID) or process name.
+ * It creates a /proc file named proc_info_module that can be accessed from user space to retrieve process information.
+ *
+ * Module Parameters:
+ *  - upid: A non-negative integer that specifies the user process ID (PID).
+ *  - upname: A string that specifies the user process name.
+ *  - use_index: Resolve process names through the process index (default) or by scanning the task list.
+ *
+ * The module parameters only give the initial target of every opened /proc file. The module can
+ * stay loaded and be queried repeatedly by writing "pid=<PID>" or "name=<NAME>" to the /proc
+ * file and reading it back; each open file keeps its own target. Batches are written as
+ * "pids=<PID>,<PID>,..." and "names=<NAME>,<NAME>,..." and answered in one read. A name may be a
+ * prefix like "php-fpm*" or a glob like "kworker/?:*", and every match reports the name it hit. Writing
+ * "bench=1,100,10000" measures the cost of formatting that many process records. Writing "tree=<PID>"
+ * reports the process and all of its descendants with their depth below it, and "threads=<PID>" every
+ * thread of the process with its state and CPU time.
+ *
+ * Sampling:
+ *  - Writing a query with an "interval=<MS>" item to /proc/proc_info_module_samples starts a sampler
+ *    that records its targets every MS milliseconds from a kernel work item; "interval=0" stops it.
+ *  - Samples are stored in lock-free per-CPU ring buffers and drained, oldest first, by reading
+ *    /proc/proc_info_module_samples. A read blocks until samples arrive while the sampler runs.
+ *  - With a "ring=shared" item, samples are stored as binary records in a single ring that user space
+ *    maps with mmap on /proc/proc_info_module_samples and consumes without a system call per sample.
+ *
+ * Process Events:
+ *  - While /proc/proc_info_module_events is open, the fork, exec and exit of every process are recorded
+ *    from the tracepoints of the process index into per-CPU ring buffers, with the parent, name, exit
+ *    status and peak resident memory of the process. Reading the file drains them, oldest first, so
+ *    processes too short-lived for any query are still seen. Events dropped because the reader fell
+ *    behind are counted and reported in the next read.
+ *
+ * Generic Netlink:
+ *  - The "PROC_INFO" generic netlink family answers requests for one PID or name with the same
+ *    fields as the /proc file, as typed attributes, so a client can pipeline many queries over one
+ *    socket. Sampler passes are also sent to its "samples" multicast group.
+ *
+ * Process Information:
+ *  - Name: Process name.
+ *  - PID: Process ID.
+ *  - PPID: PID of the process's parent.
+ *  - UID: User identifier (UID) of the process.
+ *  - Path: The path of the process in /proc.
+ *  - State: The process state as its ps letter and name, such as R (running), S (interruptible sleep),
+ *    D (uninterruptible sleep), T (stopped) or I (idle).
+ *  - Memory Usage: Resident memory (RSS) of the process in kilobytes (KB), split into anonymous, file-backed and
+ *    shared memory pages, for every process that has a user address space.
+ *  - Virtual Memory: Size of the address space of the process in kilobytes (KB).
+ *  - CPU Time: User and system CPU time of all threads of the process, including exited ones.
+ *  - Start Time: Time the process started, after boot.
+ *  - Context Switches: Voluntary and involuntary context switches of all threads of the process.
+ *  - Run Delay: Time the threads of the process spent runnable while waiting for a CPU.
+ *  - Tasks visited: Number of tasks inspected to answer the query (1 for PID lookups).
+ *  - Subtree: For tree queries, the number of processes in the subtree and their aggregate resident memory.
+ *  - Threads: For thread queries, the TID, name, state and user and system CPU time of every thread.
+ *
+ * Flow:
+ *  - Acquire process ID or name as module parameters, or from a write to the /proc file.
+ *  - Open the /proc file named proc_info_module.
+ *  - Look a process ID up in the kernel's PID hash, and a process name up in the process index. The index
+ *    is kept up to date from the fork/exec/exit tracepoints; its statistics are in /proc/proc_info_module_stats.
+ *  - If no processes with the specified ID or name are found, print an error message, log the error in the /proc file, and exit the program with exit value 2.
+ *  - Obtain information about the process.
+ *  - If the process has a user address space, read its resident and virtual memory counters.
+ *  - When the /proc file is read from the user space application, log the message to the /proc file.
+ *    The records are taken when a read starts at offset 0 and streamed through seq_file, so output of
+ *    any size can be read in chunks of any size.
+ *  - Exit the program with exit value 0.
+ *
+ * /proc file will be automatically removed when the kernel module is unloaded.
+ * If an error occurs during any of the steps, an appropriate error message will be printed, logged in the /proc file, and the program will exit with exit value 1.
+ *
+ * Authors:
+ * - [ Burak Keçeci - 290201103 ][ Berkan Gönülsever - 270201064 ]
+ *
+ * License: GPL
+ */
+
+#include <linux/module.h> // Needed by all modules
+#include <linux/kernel.h> // Needed for KERN_INFO
+#include <linux/proc_fs.h> // Needed for the proc file system
+#include <linux/seq_file.h> // Needed for streaming the /proc file output
+#include <linux/sched.h> // Needed for for_each_process macro
+#include <linux/pid.h> // Needed for find_vpid and pid_task
+#include <linux/pid_namespace.h> // Needed for sizing snapshots
+#include <linux/slab.h> // Needed for kmalloc
+#include <linux/mm.h> // Needed for kvmalloc
+#include <linux/string.h> // Needed for strsep
+#include <linux/ctype.h> // Needed for isspace
+#include <linux/uaccess.h> // Needed for memdup_user_nul
+#include <linux/ktime.h> // Needed for timing the formatting benchmark
+#include <linux/math64.h> // Needed for div_u64
+#include <linux/hashtable.h> // Needed for the process index
+#include <linux/stringhash.h> // Needed for hashing process names
+#include <linux/spinlock.h> // Needed for the process index lock
+#include <linux/rcupdate.h> // Needed for freeing index entries after readers are done
+#include <linux/tracepoint.h> // Needed for the fork/exec/exit hooks
+#include <linux/sched/clock.h> // Needed for timing index updates
+#include <linux/sched/signal.h> // Needed for signal->live
+#include <linux/workqueue.h> // Needed for the periodic sampler
+#include <linux/percpu.h> // Needed for the per-CPU sample rings
+#include <linux/wait.h> // Needed for blocking sample readers
+#include <linux/mutex.h> // Needed for the sampler configuration lock
+#include <linux/vmalloc.h> // Needed for the mappable shared sample ring
+#include <net/genetlink.h> // Needed for the generic netlink family
+#include <linux/min_heap.h> // Needed for top-N queries
+#include <linux/glob.h> // Needed for glob patterns of name queries
+#include <linux/sort.h> // Needed for ordering the index matches of a name
+
+#include "proc_info_module.h" // Binary record layout shared with user space
+
+#define PROC_FILENAME "proc_info_module"
+#define PROC_STATS_FILENAME "proc_info_module_stats"
+#define PROC_SAMPLES_FILENAME "proc_info_module_samples"
+#define PROC_EVENTS_FILENAME "proc_info_module_events"
+#define PROC_WRITE_MAX (16 * PAGE_SIZE)  // Longest accepted query write
+#define PROC_MAX_TARGETS 4096  // Most process IDs and names accepted in one query
+#define PROC_SUMMARY_TOKEN ((void *)1)  // Iterator element of the summary line after the records
+#define PROC_RECORD_MAX 512  // Upper bound of the text logged for one record or summary line
+#define PROC_BENCH_MAX 100000  // Most records formatted by one benchmark run
+#define PROC_BENCH_TOTAL_MAX 200000  // Most records formatted by all benchmark runs of a query
+#define PROC_BENCH_RUNS_MAX 32  // Most benchmark runs of a query
+#define PROC_MATCHES_HINT 64  // Records first reserved per process name in all-matches mode
+#define PROC_RECORD_SLACK 64  // Extra records reserved when a scan has to be repeated
+#define PROC_COLLECT_RETRIES 2  // Repeated scans before a changing task list truncates the output
+#define PROC_POOL_RECORDS 32  // Records of each pooled records array, enough for most queries
+#define PROC_INDEX_BITS 12  // log2 of the buckets of each process index hash table
+#define PROC_TOP_MAX 1024  // Most records reported by a top-N query
+#define PROC_TREE_DEPTH_MAX 1024  // Deepest ancestry followed when looking for a subtree root
+#define PROC_SAMPLE_SLOTS 512  // Records held by the sample ring of each CPU, a power of 2
+#define PROC_SAMPLE_INTERVAL_MAX 3600000  // Longest sampling interval in milliseconds
+#define PROC_EVENT_SLOTS 1024  // Events held by the event ring of each CPU, a power of 2
+#define PROC_SHARED_RING_SLOTS 4096  // Records held by the shared sample ring, a power of 2
+#define PROC_SHARED_RING_DATA PAGE_SIZE  // Offset of the first slot of the shared sample ring
+#define PROC_SHARED_RING_SIZE \
+    (PROC_SHARED_RING_DATA + PAGE_ALIGN(PROC_SHARED_RING_SLOTS * sizeof(struct proc_info_bin_record)))
+
+static struct proc_dir_entry *proc_file_entry;
+static struct proc_dir_entry *proc_stats_entry;
+static struct proc_dir_entry *proc_samples_entry;
+static struct proc_dir_entry *proc_events_entry;
+
+static int upid = -1;  // User process ID
+static char upname[TASK_COMM_LEN] = {0};  // User process name
+static bool use_index = true;  // Resolve process names through the process index
+
+struct linux_binprm;
+
+/*
+ * Entry of the process index.
+ *
+ * The index maps process names to the processes carrying them, so name queries visit only the
+ * matching processes instead of the whole task list. It holds one entry per thread group and is
+ * kept up to date from the sched_process_fork/exec/exit tracepoints. Entries are looked up by
+ * name under RCU and by thread group under proc_index_lock, and are freed after a grace period.
+ *
+ * Renaming through prctl(PR_SET_NAME) has no tracepoint, so the name of every match is checked
+ * against its task again; a process renamed to a queried name is only found by a linear scan
+ * (use_index=0).
+ */
+struct proc_index_entry {
+    struct hlist_node by_name;  // Link in proc_index_by_name
+    struct hlist_node by_tgid;  // Link in proc_index_by_tgid
+    struct pid *tgid;  // Thread group of the process, holds a reference
+    char comm[TASK_COMM_LEN];  // Process name when the entry was added
+    struct rcu_head rcu;
+};
+
+static DEFINE_HASHTABLE(proc_index_by_name, PROC_INDEX_BITS);
+static DEFINE_HASHTABLE(proc_index_by_tgid, PROC_INDEX_BITS);
+static DEFINE_SPINLOCK(proc_index_lock);  // Serializes index updates
+static bool proc_index_ready;  // Whether the tracepoint hooks keep the index up to date
+
+// Counters of the process index, shown in /proc/proc_info_module_stats
+static struct {
+    atomic_long_t entries;  // Processes in the index
+    atomic_long_t lookups;  // Queried names resolved through the index
+    atomic_long_t hits;  // Queried names that matched at least one process
+    atomic_long_t updates;  // Index updates from the tracepoint hooks
+    atomic_long_t failures;  // Updates that could not allocate an entry
+    atomic64_t update_ns;  // Time spent in index updates
+} proc_index_stats;
+
+/*
+ * Snapshot of one queried process.
+ *
+ * Records are taken in a single RCU pass when a read starts at offset 0 and are formatted one by
+ * one as the seq_file output is consumed. A record that is not found reports a target that did
+ * not match any process; only its PID or name is meaningful.
+ */
+struct proc_info_record {
+    char comm[TASK_COMM_LEN];  // Process name, or the queried name if not found
+    pid_t pid;  // Process ID, or the queried ID if not found
+    pid_t ppid;  // Parent process ID, -1 if there is no parent
+    uid_t uid;  // User identifier
+    unsigned int state;  // Raw task state
+    unsigned int state_index;  // Reported task state, see proc_task_states
+    unsigned long memory_usage;  // Resident memory (RSS) in KB
+    unsigned long rss_anon;  // Resident anonymous memory in KB
+    unsigned long rss_file;  // Resident file-backed memory in KB
+    unsigned long rss_shmem;  // Resident shared memory in KB
+    unsigned long vm_size;  // Virtual memory size in KB
+    u64 timestamp;  // Time the record was taken in ns since boot, 0 if not found
+    unsigned int depth;  // Generations below the root of a tree query, 0 otherwise
+    u64 utime;  // CPU time spent in user mode in ns
+    u64 stime;  // CPU time spent in kernel mode in ns
+    u64 start_time;  // Start time in ns since boot
+    unsigned long nvcsw;  // Voluntary context switches
+    unsigned long nivcsw;  // Involuntary context switches
+    u64 run_delay;  // Time spent waiting on a run queue in ns
+    unsigned int pattern;  // Number of the queried name the process matched, from 1; 0 otherwise
+    bool has_mm;  // Whether the process has a user address space
+    bool found;  // Whether the target matched a process
+};
+
+/*
+ * Predicates of a filtered snapshot.
+ *
+ * A process is only reported if every predicate that is set holds. The predicates on the task
+ * are checked before its record is taken, the memory thresholds on the record.
+ */
+struct proc_info_filter {
+    bool active;  // Whether any predicate is set
+    bool has_uid;
+    uid_t uid;  // User identifier of the process
+    bool has_ppid;
+    pid_t ppid;  // Parent process ID
+    unsigned int states;  // Bit mask of accepted state indexes, 0 accepts every state
+    bool has_min_rss;
+    unsigned long min_rss;  // Smallest resident memory in KB
+    bool has_max_rss;
+    unsigned long max_rss;  // Largest resident memory in KB
+    bool has_kthread;
+    bool kthread;  // Whether only kernel threads or only user processes are reported
+};
+
+// Kinds of a queried process name
+#define PROC_PATTERN_EXACT 0  // The whole name, e.g. "nginx"
+#define PROC_PATTERN_PREFIX 1  // The start of the name, e.g. "php-fpm*"
+#define PROC_PATTERN_GLOB 2  // A glob with '*', '?' or '[' classes, e.g. "kworker/?:*"
+
+/*
+ * Compiled form of one queried process name.
+ */
+struct proc_name_pattern {
+    unsigned char kind;  // PROC_PATTERN_* kind
+    unsigned char prefix_len;  // Length of a prefix without its '*'
+    int next;  // Next exact name in the same hash bucket, -1 at the end
+};
+
+/*
+ * Process names of a query, compiled once per query.
+ *
+ * Exact names are chained in hash buckets on hash_comm, so a task costs one hash and the names of
+ * one bucket however many exact names are queried. Prefixes and globs are tried one by one after
+ * them. A task matching several names is reported for the first of them in query order.
+ */
+struct proc_name_matcher {
+    struct proc_name_pattern *patterns;  // Compiled names, indexed like the names of the query
+    int *buckets;  // First exact name of each bucket, -1 if empty
+    unsigned int nr_buckets;  // A power of 2, 0 without exact names
+    size_t *wild;  // Indexes of the prefixes and globs, in query order
+    size_t nr_wild;
+};
+
+/*
+ * Result of one formatting benchmark run.
+ */
+struct proc_info_bench {
+    size_t nr_records;  // Records to format
+    size_t bytes;  // Bytes of text the records took
+    u64 elapsed;  // Time spent formatting in ns
+};
+
+/*
+ * Matches of one queried process name.
+ */
+struct proc_info_match {
+    size_t count;  // Number of matching tasks
+    unsigned long memory_usage;  // Aggregate resident memory of the matching tasks in KB
+    u64 start_time;  // Start time of the process reported without match=all
+    pid_t pid;  // Process ID of the process reported without match=all
+};
+
+/*
+ * Query state of a single open /proc file.
+ *
+ * Every open file starts from the upid/upname module parameters and can be retargeted by
+ * writing a query to it, so concurrent readers do not share a target. A query is a list of
+ * whitespace separated "pid=<PID>", "name=<NAME>", "pids=<PID>,<PID>,..." and
+ * "names=<NAME>,<NAME>,..." items, and a batch of targets is answered in a single read. A name
+ * ending in '*' matches a prefix, and one holding '*', '?' or '[' elsewhere is a glob.
+ * A "match=all" item reports every task with a queried name instead of only the first one, and
+ * a "format=binary" item switches the output to struct proc_info_bin_record. A "mode=snapshot"
+ * item takes no targets and reports every process with one compact line each, or only the processes
+ * matching its "uid=", "ppid=", "state=", "min_rss=", "max_rss=" and "kthread=" filters. A
+ * "topn=<N>" item makes a snapshot of only the N processes ranking highest by the "key=rss|vm|cpu"
+ * item, resident memory by default, highest first. A "tree=<PID>" item takes no other targets and
+ * reports the subtree of the process, one indented line each, and a "threads=<PID>" item the
+ * threads of the process, one line each. An "interval=<MS>" item is only accepted by the samples
+ * file and configures the sampler; a "ring=shared" item then sends the samples to the mappable
+ * shared ring.
+ *
+ * The state lives in the private data of the seq_file and is protected by its lock.
+ */
+struct proc_info_query {
+    int *pids;  // Queried process IDs
+    size_t nr_pids;
+    char (*names)[TASK_COMM_LEN];  // Queried process names or patterns
+    size_t nr_names;
+    struct proc_name_matcher matcher;  // Compiled names, set up by compile_name_matcher
+    bool all_matches;  // Report every task with a queried name, not only the first one
+    bool binary;  // Emit binary records instead of text
+    bool snapshot;  // Report every process instead of the targets
+    struct proc_info_filter filter;  // Predicates of the processes reported by a snapshot
+    unsigned int top_n;  // Report only the snapshot records ranking highest by top_key, 0 for all
+    unsigned int top_key;  // Index of the ranking in proc_top_keys
+    unsigned long matched;  // Processes of a snapshot that passed the filter
+    bool tree;  // Report the subtree of tree_root instead of the targets
+    int tree_root;  // Process ID of the root of the subtree
+    size_t tree_count;  // Processes in the subtree
+    unsigned long tree_memory;  // Aggregate resident memory of the subtree in KB
+    bool threads;  // Report the threads of threads_pid instead of the targets
+    int threads_pid;  // Process ID of the process whose threads are reported
+    size_t thread_count;  // Threads of the process
+    struct proc_info_bench *bench;  // Formatting benchmark runs
+    size_t nr_bench;
+    bool bench_done;  // The benchmarks ran, they run once per query on its first read
+    bool sample;  // The query configures the sampler
+    unsigned int interval_ms;  // Sampling interval in milliseconds, 0 stops the sampler
+    bool shared;  // Store samples in the shared ring instead of the per-CPU rings
+    struct proc_info_record *records;  // Result of the last read started at offset 0
+    size_t records_capacity;  // Records the array can hold
+    size_t nr_records;
+    size_t nr_dropped;  // Records that did not fit because the task list kept growing
+    struct proc_info_match *matches;  // Matches of each queried process name
+    unsigned long visited;  // Tasks inspected to produce the records
+};
+
+/*
+ * Pool of records arrays.
+ *
+ * Every read at offset 0 needs a records array. Each CPU keeps one spare array of
+ * PROC_POOL_RECORDS records, allocated at load time: small queries take it instead of
+ * allocating, and return it when their records are dropped. Larger arrays bypass the pool.
+ */
+static DEFINE_PER_CPU(struct proc_info_record *, proc_record_pool);
+
+// Counters of the records array pool, shown in /proc/proc_info_module_stats
+static struct {
+    atomic_long_t hits;  // Arrays taken from the pool
+    atomic_long_t misses;  // Pool sized arrays allocated because the pool of the CPU was empty
+    atomic_long_t oversized;  // Arrays too large for the pool
+} proc_pool_stats;
+
+/*
+ * Sample ring buffer of one CPU.
+ *
+ * The sampler is the only producer and the reader holding proc_sample_read_lock the only
+ * consumer, so the ring needs no lock: the producer publishes a record by advancing head with
+ * release semantics after writing it, and the consumer frees the slot by advancing tail the same
+ * way after copying it out. Both indices grow without wrapping and are masked on access.
+ */
+struct proc_sample_ring {
+    unsigned long head;  // Next slot to write, advanced by the producer
+    unsigned long tail;  // Next slot to read, advanced by the consumer
+    unsigned long dropped;  // Records lost because the ring was full, written by the producer
+    struct proc_info_record *slots;  // PROC_SAMPLE_SLOTS records, allocated when sampling first starts
+};
+
+static DEFINE_PER_CPU(struct proc_sample_ring, proc_sample_rings);
+static DEFINE_MUTEX(proc_sampler_lock);  // Serializes sampler configuration
+static DEFINE_MUTEX(proc_sample_read_lock);  // Serializes sample readers
+static DECLARE_WAIT_QUEUE_HEAD(proc_sample_wait);  // Readers waiting for samples
+
+// Shared sample ring, allocated on its first use and kept until the module is unloaded
+static struct proc_info_ring_header *proc_shared_ring;
+
+/*
+ * Lifecycle event of a process.
+ *
+ * Events are recorded by the fork/exec/exit tracepoint probes while the events /proc file is open,
+ * so processes that live shorter than any polling interval are still seen.
+ */
+struct proc_info_event {
+    u64 timestamp;  // Time of the event in ns since boot
+    unsigned int type;  // PROC_INFO_EVENT_* type
+    pid_t pid;  // Process ID
+    pid_t ppid;  // Parent process ID
+    int exit_code;  // Wait status of an exit event, 0 otherwise
+    unsigned long peak_rss;  // Peak resident memory in KB
+    unsigned long lost;  // Events dropped since the previous one, for PROC_INFO_EVENT_LOST
+    char comm[TASK_COMM_LEN];  // Process name, the new program for exec events
+};
+
+/*
+ * Event ring buffer of one CPU.
+ *
+ * Works like the sample rings: the probes running on the CPU are the only producer, with
+ * preemption disabled, and the reader holding proc_event_read_lock the only consumer.
+ */
+struct proc_event_ring {
+    unsigned long head;  // Next slot to write, advanced by the producer
+    unsigned long tail;  // Next slot to read, advanced by the consumer
+    unsigned long dropped;  // Events lost because the ring was full, written by the producer
+    struct proc_info_event *slots;  // PROC_EVENT_SLOTS events, allocated when the events file is first opened
+};
+
+/*
+ * Reader state of a single open events /proc file.
+ */
+struct proc_event_reader {
+    bool binary;  // Emit binary records instead of text
+    unsigned long reported;  // Dropped events already reported to this reader
+};
+
+static DEFINE_PER_CPU(struct proc_event_ring, proc_event_rings);
+static DEFINE_MUTEX(proc_event_lock);  // Serializes opening and closing the events file
+static DEFINE_MUTEX(proc_event_read_lock);  // Serializes event readers
+static DECLARE_WAIT_QUEUE_HEAD(proc_event_wait);  // Readers waiting for events
+
+// State of the event recording
+static struct {
+    atomic_t readers;  // Open events files, events are only recorded while there is one
+    bool closing;  // The module is being unloaded, readers return instead of waiting
+    atomic_long_t recorded;  // Events stored in the rings
+} proc_events;
+
+static struct genl_family proc_info_family;  // Generic netlink family, registered at load time
+
+static void sample_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(proc_sample_work, sample_work);  // Runs one sampling pass per interval
+
+// State of the sampler, changed under proc_sampler_lock while the work item is cancelled
+static struct {
+    struct proc_info_query query;  // Targets of the sampler
+    struct proc_info_record *scratch;  // Records of the pass in progress
+    size_t capacity;  // Records the scratch array can hold
+    unsigned long interval;  // Sampling interval in jiffies, 0 when stopped
+    unsigned long next_tick;  // Deadline of the next pass in jiffies
+    bool binary;  // Readers get binary records instead of text
+    bool shared;  // Samples go to the shared ring
+    u32 shared_head;  // Next slot of the shared ring, the copy in the mapping is only published
+    unsigned long shared_dropped;  // Samples lost because the shared ring was full
+    atomic_long_t passes;  // Completed sampling passes
+    atomic_long_t samples;  // Records stored in the rings
+    atomic_long_t overflows;  // Records that did not fit in the scratch array
+    atomic_long_t late;  // Passes that started more than one interval late
+} proc_sampler;
+
+/*
+ * Write position in a text buffer.
+ *
+ * All text output is formatted through a cursor, which appends at a tracked offset with
+ * scnprintf. Building output stays linear in its size instead of rescanning the buffer with
+ * strlen for every append, and never writes past the capacity of the buffer.
+ */
+struct proc_info_cursor {
+    char *buf;
+    size_t len;  // Bytes written so far, excluding the terminating NUL
+    size_t size;  // Capacity of the buffer
+};
+
+
+/**
+ * Convert the process state to string.
+ * 
+ * @state: The state index of the process, as returned by task_state_index().
+*/
+static const char* get_state_string(unsigned int state);
+
+/**
+ * Convert the process state to the letter used by ps and /proc/<pid>/stat.
+ *
+ * @state: The state index of the process, as returned by task_state_index().
+ */
+static char get_state_char(unsigned int state);
+
+/**
+ * Check if the task matches one of the queried process names.
+ *
+ * This function matches the process name of the given task against the compiled names of the
+ * query, see struct proc_name_matcher. Without match=all, names that already have their match
+ * are skipped, so the task goes to the first name in query order that still needs one. Process
+ * IDs are not matched here, they are looked up in the PID hash instead.
+ *
+ * @task: Pointer to the task structure to check.
+ * @query: Query holding the process names to match.
+ * @found_name: Pointer to store the index of the matched process name (if found).
+ *
+ * @return: 0 if the task matches one of the queried process names, 1 otherwise.
+ */
+static int get_process_info(struct task_struct *task, const struct proc_info_query *query,
+                            size_t *found_name);
+
+/**
+ * Open callback function for the /proc file.
+ *
+ * This function is called when the /proc file is opened. It opens the seq_file of the /proc file
+ * and initializes its query state from the module parameters.
+ *
+ * @inode: Pointer to the inode of the /proc file.
+ * @file: Pointer to the file structure.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int open_proc(struct inode *inode, struct file *file);
+
+/**
+ * Release callback function for the /proc file.
+ *
+ * This function is called when the last reference to an open /proc file is dropped. It frees
+ * the query state and the seq_file of the file.
+ *
+ * @inode: Pointer to the inode of the /proc file.
+ * @file: Pointer to the file structure.
+ *
+ * @return: Always 0.
+ */
+static int release_proc(struct inode *inode, struct file *file);
+
+/**
+ * Start callback function of the /proc file iterator.
+ *
+ * This function is called when the /proc file is read. At offset 0 it retrieves information
+ * about the queried process IDs and process names; at any offset it returns the record at the
+ * given position, so output of any size is streamed in page sized chunks.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @pos: Pointer to the position of the first record to show.
+ *
+ * @return: The record at the position, PROC_SUMMARY_TOKEN for the summary line, NULL at the end of
+ *          the output, or an error pointer on failure.
+ */
+static void *start_proc(struct seq_file *m, loff_t *pos);
+
+/**
+ * Next callback function of the /proc file iterator.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record that was shown last.
+ * @pos: Pointer to the position of the record that was shown last.
+ *
+ * @return: The next record, PROC_SUMMARY_TOKEN for the summary line, or NULL at the end.
+ */
+static void *next_proc(struct seq_file *m, void *v, loff_t *pos);
+
+/**
+ * Stop callback function of the /proc file iterator.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record that was shown last.
+ */
+static void stop_proc(struct seq_file *m, void *v);
+
+/**
+ * Show callback function of the /proc file iterator.
+ *
+ * This function writes one record, or the summary line, to the seq_file. Files in binary mode
+ * get the binary layout of the record and no summary line.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record to show.
+ *
+ * @return: Always 0.
+ */
+static int show_proc(struct seq_file *m, void *v);
+
+/**
+ * Write callback function for the /proc file.
+ *
+ * This function is called when the /proc file is written. It parses a query, see struct
+ * proc_info_query: "pid=", "name=", "pids=" and "names=" targets, where names may be prefixes
+ * or globs, with "match=all" and "format=binary"; "mode=snapshot" with its "uid=", "ppid=",
+ * "state=", "min_rss=", "max_rss=" and "kthread=" filters; "topn=" with "key="; "tree=",
+ * "threads=" or "bench=". The query replaces the query state of the open file, and the file
+ * offset is rewound so the next read reports the new targets.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the query.
+ * @count: Size of the user buffer.
+ * @offset: Pointer to the file offset.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_proc(struct file *file, const char __user *buffer, size_t count, loff_t *offset);
+
+/**
+ * Read callback function of the samples /proc file.
+ *
+ * This function drains samples from the rings, oldest first, as one text line or one binary
+ * record each. Only whole samples are returned. While the sampler runs, a read without any
+ * sample waits for the next pass unless the file is non-blocking; once it stops, the remaining
+ * samples are returned and then the end of the file.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer to copy the samples to.
+ * @count: Size of the user buffer.
+ * @offset: Unused, samples are consumed by reading them.
+ *
+ * @return: Number of bytes read, or a negative error code on failure.
+ */
+static ssize_t read_samples(struct file *file, char __user *buffer, size_t count, loff_t *offset);
+
+/**
+ * Write callback function of the samples /proc file.
+ *
+ * This function parses a sampler query, made of the targets and options of a /proc file query
+ * and an "interval=<MS>" item, and reconfigures the sampler with it.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the query.
+ * @count: Size of the user buffer.
+ * @offset: Unused.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_samples(struct file *file, const char __user *buffer, size_t count,
+                             loff_t *offset);
+
+/**
+ * Mmap callback function of the samples /proc file.
+ *
+ * This function maps the shared sample ring, allocating it on first use. Only shared mappings
+ * from offset 0 are accepted, since the consumer publishes its progress by writing tail.
+ *
+ * @file: Pointer to the file structure.
+ * @vma: The user space area to map the ring into.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int mmap_samples(struct file *file, struct vm_area_struct *vma);
+
+/**
+ * Open callback function of the events /proc file.
+ *
+ * This function starts recording process events when the first events file is opened, with
+ * empty rings, and sets the file up for text output.
+ *
+ * @inode: Pointer to the inode structure.
+ * @file: Pointer to the file structure.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int open_events(struct inode *inode, struct file *file);
+
+/**
+ * Read callback function of the events /proc file.
+ *
+ * This function drains events from the rings, oldest first, as one text line or one binary
+ * record each, after a record counting the events dropped since the previous read if any. A
+ * read without any event waits for the next one unless the file is non-blocking.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer to copy the events to.
+ * @count: Size of the user buffer.
+ * @offset: Unused, events are consumed by reading them.
+ *
+ * @return: Number of bytes read, or a negative error code on failure.
+ */
+static ssize_t read_events(struct file *file, char __user *buffer, size_t count, loff_t *offset);
+
+/**
+ * Write callback function of the events /proc file.
+ *
+ * This function switches the open file between text and binary output, on "format=text" and
+ * "format=binary".
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the format.
+ * @count: Size of the user buffer.
+ * @offset: Unused.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_events(struct file *file, const char __user *buffer, size_t count,
+                            loff_t *offset);
+
+/**
+ * Release callback function of the events /proc file.
+ *
+ * This function stops recording process events when the last events file is closed.
+ *
+ * @inode: Pointer to the inode structure.
+ * @file: Pointer to the file structure.
+ *
+ * @return: Always 0.
+ */
+static int release_events(struct inode *inode, struct file *file);
+
+/**
+ * Handler of PROC_INFO_CMD_GET generic netlink requests.
+ *
+ * This function answers a request for one process ID or name, like a query written to the /proc
+ * file, with one PROC_INFO_CMD_RECORDS message holding a nested attribute per record.
+ *
+ * @skb: The request message.
+ * @info: Attributes and sender of the request.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int get_proc_nl(struct sk_buff *skb, struct genl_info *info);
+
+/**
+ * Initialization function for the module.
+ *
+ * This function is called when the module is loaded into the kernel. It builds the process index,
+ * registers the generic netlink family, creates the /proc file entries and registers the file
+ * callback functions.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int proc_info_module_init(void);
+
+/**
+ * Cleanup function for the module.
+ *
+ * This function is called when the module is unloaded from the kernel. It stops the sampler and
+ * removes the /proc file entries, the generic netlink family and the process index.
+ */
+static void proc_info_module_exit(void);
+
+// Iterator over the records of the /proc file
+static const struct seq_operations proc_seq_ops = {
+    .start = start_proc,
+    .next = next_proc,
+    .stop = stop_proc,
+    .show = show_proc,
+};
+
+// File operations structure for the /proc file
+static const struct proc_ops proc_fops = {
+    .proc_open = open_proc,
+    .proc_read = seq_read,
+    .proc_write = write_proc,
+    .proc_lseek = seq_lseek,
+    .proc_release = release_proc,
+};
+
+// File operations structure for the samples /proc file
+static const struct proc_ops proc_samples_fops = {
+    .proc_read = read_samples,
+    .proc_write = write_samples,
+    .proc_mmap = mmap_samples,
+    .proc_lseek = noop_llseek,
+};
+
+// File operations structure for the events /proc file
+static const struct proc_ops proc_events_fops = {
+    .proc_open = open_events,
+    .proc_read = read_events,
+    .proc_write = write_events,
+    .proc_lseek = noop_llseek,
+    .proc_release = release_events,
+};
+
+/*
+ * Letters and names of the reported task states, indexed by task_state_index().
+ *
+ * task_state_index() folds the raw state bits and exit_state into one bit of TASK_REPORT, so
+ * combined states such as TASK_KILLABLE report as their sleep state and TASK_IDLE as idle,
+ * instead of matching no single value.
+ */
+static const struct {
+    char letter;
+    const char *name;
+} proc_task_states[] = {
+    { 'R', "Running" },  // TASK_RUNNING
+    { 'S', "Interruptible Sleep" },  // TASK_INTERRUPTIBLE
+    { 'D', "Uninterruptible Sleep" },  // TASK_UNINTERRUPTIBLE
+    { 'T', "Stopped" },  // __TASK_STOPPED
+    { 't', "Traced" },  // __TASK_TRACED
+    { 'X', "Dead" },  // EXIT_DEAD
+    { 'Z', "Zombie" },  // EXIT_ZOMBIE
+    { 'P', "Parked" },  // TASK_PARKED
+    { 'I', "Idle" },  // TASK_REPORT_IDLE
+};
+
+/**
+ * Convert the process state to string.
+ * 
+ * @state: The state index of the process, as returned by task_state_index().
+*/
+static const char* get_state_string(unsigned int state) {
+    if (state >= ARRAY_SIZE(proc_task_states))
+        return "Unknown";
+    return proc_task_states[state].name;
+}
+
+/**
+ * Convert the process state to the letter used by ps and /proc/<pid>/stat.
+ *
+ * @state: The state index of the process, as returned by task_state_index().
+ */
+static char get_state_char(unsigned int state)
+{
+    if (state >= ARRAY_SIZE(proc_task_states))
+        return '?';
+    return proc_task_states[state].letter;
+}
+
+/**
+ * Hash a process name for the process index and the exact names of a query.
+ *
+ * @comm: The process name, at most TASK_COMM_LEN bytes.
+ *
+ * @return: The hash of the name.
+ */
+static u32 hash_comm(const char *comm)
+{
+    return full_name_hash(NULL, comm, strnlen(comm, TASK_COMM_LEN));
+}
+
+/**
+ * Check if the task matches one of the queried process names.
+ *
+ * This function matches the process name of the given task against the compiled names of the
+ * query, see struct proc_name_matcher. Without match=all, names that already have their match
+ * are skipped, so the task goes to the first name in query order that still needs one. Process
+ * IDs are not matched here, they are looked up in the PID hash instead.
+ *
+ * @task: Pointer to the task structure to check.
+ * @query: Query holding the process names to match.
+ * @found_name: Pointer to store the index of the matched process name (if found).
+ *
+ * @return: 0 if the task matches one of the queried process names, 1 otherwise.
+ */
+static int get_process_info(struct task_struct *task, const struct proc_info_query *query,
+                            size_t *found_name)
+{
+    const struct proc_name_matcher *matcher = &query->matcher;
+    const struct proc_name_pattern *pattern;
+    size_t i, found = query->nr_names;
+    int n;
+
+    if (matcher->nr_buckets) {
+        n = matcher->buckets[hash_comm(task->comm) & (matcher->nr_buckets - 1)];
+        for (; n >= 0; n = matcher->patterns[n].next) {
+            if (!query->all_matches && query->matches[n].count)
+                continue;
+            if (strcmp(task->comm, query->names[n]) == 0) {
+                found = n;
+                break;
+            }
+        }
+    }
+
+    // Prefixes and globs are only tried up to an exact name that already matched
+    for (i = 0; i < matcher->nr_wild && matcher->wild[i] < found; i++) {
+        n = matcher->wild[i];
+        pattern = &matcher->patterns[n];
+        if (!query->all_matches && query->matches[n].count)
+            continue;
+        if (pattern->kind == PROC_PATTERN_PREFIX ?
+            strncmp(task->comm, query->names[n], pattern->prefix_len) == 0 :
+            glob_match(query->names[n], task->comm)) {
+            found = n;
+            break;
+        }
+    }
+
+    if (found == query->nr_names)
+        return 1;
+    *found_name = found;
+    return 0;
+}
+
+/**
+ * Take a snapshot of the fields of a task that do not add up its threads.
+ *
+ * The CPU and context switch counters are left 0 for the caller. This function must be called
+ * under rcu_read_lock().
+ *
+ * @task: Pointer to the task structure of the process or thread.
+ * @record: Pointer to the record to fill.
+ */
+static void fill_task_record(struct task_struct *task, struct proc_info_record *record)
+{
+    struct task_struct *parent_task = task->parent;
+    struct mm_struct *mm;
+
+    memset(record, 0, sizeof(*record));
+    memcpy(record->comm, task->comm, TASK_COMM_LEN);
+    record->pid = task->pid;
+    record->ppid = parent_task ? parent_task->pid : -1;
+    record->uid = task_uid(task).val;
+    record->state = READ_ONCE(task->__state);
+    record->state_index = task_state_index(task);
+    record->start_time = task->start_boottime;
+
+    // task_lock keeps the mm from being released by a concurrent exit; kernel threads only borrow one
+    task_lock(task);
+    mm = task->mm;
+    if (mm && !(task->flags & PF_KTHREAD)) {
+        record->has_mm = true;
+        record->rss_anon = get_mm_counter(mm, MM_ANONPAGES) << (PAGE_SHIFT - 10);
+        record->rss_file = get_mm_counter(mm, MM_FILEPAGES) << (PAGE_SHIFT - 10);
+        record->rss_shmem = get_mm_counter(mm, MM_SHMEMPAGES) << (PAGE_SHIFT - 10);
+        record->vm_size = READ_ONCE(mm->total_vm) << (PAGE_SHIFT - 10);
+        record->memory_usage = record->rss_anon + record->rss_file + record->rss_shmem;
+    }
+    task_unlock(task);
+
+    record->timestamp = ktime_get_ns();
+    record->found = true;
+}
+
+/**
+ * Take a snapshot of the information of a process.
+ *
+ * This function must be called under rcu_read_lock().
+ *
+ * @task: Pointer to the task structure of the process.
+ * @record: Pointer to the record to fill.
+ */
+static void fill_process_record(struct task_struct *task, struct proc_info_record *record)
+{
+    struct task_struct *thread;
+
+    fill_task_record(task, record);
+
+    /*
+     * Like /proc/<pid>/stat, the counters of a process add up its live threads and the threads
+     * that already exited, whose counters are folded into the signal struct. They are read
+     * without siglock, so a thread exiting meanwhile may be missed or counted twice; with full
+     * dynticks accounting they lag behind by the current tick period.
+     */
+    record->utime = READ_ONCE(task->signal->utime);
+    record->stime = READ_ONCE(task->signal->stime);
+    record->nvcsw = READ_ONCE(task->signal->nvcsw);
+    record->nivcsw = READ_ONCE(task->signal->nivcsw);
+    for_each_thread(task, thread) {
+        record->utime += READ_ONCE(thread->utime);
+        record->stime += READ_ONCE(thread->stime);
+        record->nvcsw += READ_ONCE(thread->nvcsw);
+        record->nivcsw += READ_ONCE(thread->nivcsw);
+#ifdef CONFIG_SCHED_INFO
+        record->run_delay += READ_ONCE(thread->sched_info.run_delay);
+#endif
+    }
+}
+
+/**
+ * Take a snapshot of the information of a single thread.
+ *
+ * The record is filled like the record of a process, but its CPU counters are only those of
+ * the thread, so a thread list costs one pass over the threads. This function must be called
+ * under rcu_read_lock().
+ *
+ * @task: Pointer to the task structure of the thread.
+ * @record: Pointer to the record to fill.
+ */
+static void fill_thread_record(struct task_struct *task, struct proc_info_record *record)
+{
+    fill_task_record(task, record);
+    record->utime = READ_ONCE(task->utime);
+    record->stime = READ_ONCE(task->stime);
+    record->nvcsw = READ_ONCE(task->nvcsw);
+    record->nivcsw = READ_ONCE(task->nivcsw);
+#ifdef CONFIG_SCHED_INFO
+    record->run_delay = READ_ONCE(task->sched_info.run_delay);
+#endif
+}
+
+/**
+ * Append formatted text at the position of a cursor.
+ *
+ * Text that does not fit in the remaining capacity is truncated.
+ *
+ * @cursor: Pointer to the cursor to append to.
+ * @fmt: printf style format string.
+ */
+static __printf(2, 3) void cursor_printf(struct proc_info_cursor *cursor, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    cursor->len += vscnprintf(cursor->buf + cursor->len, cursor->size - cursor->len, fmt, args);
+    va_end(args);
+}
+
+/**
+ * Log the information of a process to a text buffer.
+ *
+ * This function appends the information of a process record at the position of the cursor.
+ *
+ * @cursor: Pointer to the cursor of the buffer to write to.
+ * @record: Pointer to the record of the process.
+ */
+static void log_process_info(struct proc_info_cursor *cursor, const struct proc_info_record *record)
+{
+    if (!record->found) {
+        if (record->comm[0] != '\0')
+            cursor_printf(cursor, "Error: Process with name %s not found.\n", record->comm);
+        else
+            cursor_printf(cursor, "Error: Process with ID %d not found.\n", record->pid);
+        return;
+    }
+
+    cursor_printf(cursor, "Name: %s\n", record->comm);
+    cursor_printf(cursor, "PID: %d\n", record->pid);
+    cursor_printf(cursor, "PPID: %d\n", record->ppid);
+    cursor_printf(cursor, "UID: %u\n", record->uid);
+    cursor_printf(cursor, "Path: /proc/%d\n", record->pid);
+    cursor_printf(cursor, "State: %c (%s)\n", get_state_char(record->state_index),
+                  get_state_string(record->state_index));
+    if (record->has_mm) {
+        cursor_printf(cursor, "Memory usage: %lu KB (anon %lu KB, file %lu KB, shmem %lu KB)\n",
+                      record->memory_usage, record->rss_anon, record->rss_file, record->rss_shmem);
+        cursor_printf(cursor, "Virtual memory: %lu KB\n", record->vm_size);
+    } else {
+        cursor_printf(cursor, "Memory usage: No user memory (kernel thread).\n");
+    }
+    cursor_printf(cursor, "CPU time: user %llu ms, system %llu ms\n",
+                  div_u64(record->utime, NSEC_PER_MSEC), div_u64(record->stime, NSEC_PER_MSEC));
+    cursor_printf(cursor, "Start time: %llu ms after boot\n", div_u64(record->start_time, NSEC_PER_MSEC));
+    cursor_printf(cursor, "Context switches: %lu voluntary, %lu involuntary\n",
+                  record->nvcsw, record->nivcsw);
+#ifdef CONFIG_SCHED_INFO
+    cursor_printf(cursor, "Run delay: %llu ms\n", div_u64(record->run_delay, NSEC_PER_MSEC));
+#endif
+}
+
+/**
+ * Log the information of a process as one compact line.
+ *
+ * Snapshots use this format so a whole system fits in little output. Every field is a
+ * "key=value" pair and the name comes last, as it may contain spaces.
+ *
+ * @cursor: Pointer to the cursor of the buffer to write to.
+ * @record: Pointer to the record of the process.
+ */
+static void log_process_line(struct proc_info_cursor *cursor, const struct proc_info_record *record)
+{
+    cursor_printf(cursor, "pid=%d ppid=%d uid=%u state=%c mem=%lu anon=%lu file=%lu shmem=%lu vm=%lu "
+                  "utime=%llu stime=%llu name=%s\n",
+                  record->pid, record->ppid, record->uid, get_state_char(record->state_index),
+                  record->memory_usage,
+                  record->rss_anon, record->rss_file, record->rss_shmem, record->vm_size,
+                  div_u64(record->utime, NSEC_PER_MSEC), div_u64(record->stime, NSEC_PER_MSEC),
+                  record->comm);
+}
+
+/**
+ * Log a thread as one compact line.
+ *
+ * @cursor: Pointer to the cursor of the buffer to write to.
+ * @record: Pointer to the record of the thread.
+ */
+static void log_thread_line(struct proc_info_cursor *cursor, const struct proc_info_record *record)
+{
+    cursor_printf(cursor, "tid=%d state=%c cpu=%llu ms user=%llu ms system=%llu ms "
+                  "nvcsw=%lu nivcsw=%lu run_delay=%llu ms name=%s\n",
+                  record->pid, get_state_char(record->state_index),
+                  div_u64(record->utime + record->stime, NSEC_PER_MSEC),
+                  div_u64(record->utime, NSEC_PER_MSEC), div_u64(record->stime, NSEC_PER_MSEC),
+                  record->nvcsw, record->nivcsw, div_u64(record->run_delay, NSEC_PER_MSEC),
+                  record->comm);
+}
+
+/**
+ * Log a process of a subtree as one compact line, indented by its depth.
+ *
+ * @cursor: Pointer to the cursor of the buffer to write to.
+ * @record: Pointer to the record of the process.
+ */
+static void log_tree_line(struct proc_info_cursor *cursor, const struct proc_info_record *record)
+{
+    // The indentation is capped, so deep trees stay within one record of text
+    cursor_printf(cursor, "%*sdepth=%u ", (int)(2 * min(record->depth, 32U)), "", record->depth);
+    log_process_line(cursor, record);
+}
+
+/**
+ * Log a sample in one line.
+ *
+ * @cursor: Cursor of the text buffer to append the line to.
+ * @record: Pointer to the sampled record.
+ */
+static void log_sample_line(struct proc_info_cursor *cursor, const struct proc_info_record *record)
+{
+    cursor_printf(cursor, "time=%llu ", record->timestamp);
+    log_process_line(cursor, record);
+}
+
+// Names of the event types, indexed by PROC_INFO_EVENT_*
+static const char *const proc_event_names[] = {
+    [PROC_INFO_EVENT_FORK] = "fork",
+    [PROC_INFO_EVENT_EXEC] = "exec",
+    [PROC_INFO_EVENT_EXIT] = "exit",
+    [PROC_INFO_EVENT_LOST] = "lost",
+};
+
+/**
+ * Log a process event in one line.
+ *
+ * @cursor: Cursor of the text buffer to append the line to.
+ * @event: Pointer to the event.
+ */
+static void log_event_line(struct proc_info_cursor *cursor, const struct proc_info_event *event)
+{
+    cursor_printf(cursor, "time=%llu event=%s ", event->timestamp, proc_event_names[event->type]);
+    if (event->type == PROC_INFO_EVENT_LOST) {
+        cursor_printf(cursor, "count=%lu\n", event->lost);
+        return;
+    }
+
+    cursor_printf(cursor, "pid=%d ppid=%d name=%s peak_rss=%lu", event->pid, event->ppid,
+                  event->comm, event->peak_rss);
+    // The wait status holds the terminating signal in its low bits, or the exit status above them
+    if (event->type == PROC_INFO_EVENT_EXIT && (event->exit_code & 0x7f))
+        cursor_printf(cursor, " signal=%d", event->exit_code & 0x7f);
+    else if (event->type == PROC_INFO_EVENT_EXIT)
+        cursor_printf(cursor, " exit=%d", (event->exit_code >> 8) & 0xff);
+    cursor_printf(cursor, "\n");
+}
+
+/**
+ * Convert a process record to its binary layout.
+ *
+ * @record: Pointer to the record of the process.
+ * @bin: Pointer to the binary record to fill.
+ */
+static void pack_process_record(const struct proc_info_record *record,
+                                struct proc_info_bin_record *bin)
+{
+    memset(bin, 0, sizeof(*bin));
+    bin->version = PROC_INFO_RECORD_VERSION;
+    bin->size = sizeof(*bin);
+    bin->flags = record->found ? PROC_INFO_RECORD_FOUND : 0;
+    if (record->has_mm)
+        bin->flags |= PROC_INFO_RECORD_HAS_MM;
+    bin->pid = record->pid;
+    bin->ppid = record->ppid;
+    bin->uid = record->uid;
+    bin->state = record->state;
+    bin->state_index = record->state_index;
+    bin->state_char = get_state_char(record->state_index);
+    bin->memory_usage = record->memory_usage;
+    memcpy(bin->comm, record->comm, PROC_INFO_COMM_LEN);
+    bin->rss_anon = record->rss_anon;
+    bin->rss_file = record->rss_file;
+    bin->rss_shmem = record->rss_shmem;
+    bin->vm_size = record->vm_size;
+    bin->timestamp = record->timestamp;
+    bin->depth = record->depth;
+    bin->utime = record->utime;
+    bin->stime = record->stime;
+    bin->start_time = record->start_time;
+    bin->nvcsw = record->nvcsw;
+    bin->nivcsw = record->nivcsw;
+    bin->run_delay = record->run_delay;
+    bin->pattern = record->pattern;
+}
+
+/**
+ * Convert a process event to its binary layout.
+ *
+ * @event: Pointer to the event.
+ * @bin: Pointer to the binary record to fill.
+ */
+static void pack_event_record(const struct proc_info_event *event,
+                              struct proc_info_event_record *bin)
+{
+    memset(bin, 0, sizeof(*bin));
+    bin->version = PROC_INFO_EVENT_VERSION;
+    bin->size = sizeof(*bin);
+    bin->type = event->type;
+    bin->pid = event->pid;
+    bin->ppid = event->ppid;
+    bin->exit_code = event->exit_code;
+    bin->lost = min_t(unsigned long, event->lost, U32_MAX);
+    bin->timestamp = event->timestamp;
+    bin->peak_rss = event->peak_rss;
+    memcpy(bin->comm, event->comm, PROC_INFO_COMM_LEN);
+}
+
+/**
+ * Size of the netlink attributes of one process record.
+ *
+ * @return: Bytes needed by put_record_attrs() for any record.
+ */
+static size_t record_attrs_size(void)
+{
+    return nla_total_size(0)  // PROC_INFO_ATTR_RECORD
+           + 2 * nla_total_size(0)  // Flags
+           + nla_total_size(TASK_COMM_LEN)  // Name
+           + 4 * nla_total_size(sizeof(u32))  // PID, PPID, UID and raw state
+           + nla_total_size(sizeof(u8))  // State letter
+           + nla_total_size(sizeof(u16))  // Pattern
+           + 12 * nla_total_size_64bit(sizeof(u64));  // Memory, time and context switch counters
+}
+
+/**
+ * Convert a process record to netlink attributes.
+ *
+ * This function appends one PROC_INFO_ATTR_RECORD attribute nesting the fields of the record.
+ * A record that is not found only carries the queried PID or name.
+ *
+ * @skb: The message to append to.
+ * @record: Pointer to the record of the process.
+ *
+ * @return: 0 on success, or -EMSGSIZE if the message is full.
+ */
+static int put_record_attrs(struct sk_buff *skb, const struct proc_info_record *record)
+{
+    struct nlattr *nest;
+
+    nest = nla_nest_start(skb, PROC_INFO_ATTR_RECORD);
+    if (!nest)
+        return -EMSGSIZE;
+
+    if (!record->found) {
+        if (record->comm[0] != '\0' ? nla_put_string(skb, PROC_INFO_ATTR_NAME, record->comm) :
+                                      nla_put_s32(skb, PROC_INFO_ATTR_PID, record->pid))
+            goto cancel;
+        nla_nest_end(skb, nest);
+        return 0;
+    }
+
+    if (nla_put_flag(skb, PROC_INFO_ATTR_FOUND) ||
+        (record->has_mm && nla_put_flag(skb, PROC_INFO_ATTR_HAS_MM)) ||
+        nla_put_s32(skb, PROC_INFO_ATTR_PID, record->pid) ||
+        nla_put_string(skb, PROC_INFO_ATTR_NAME, record->comm) ||
+        nla_put_s32(skb, PROC_INFO_ATTR_PPID, record->ppid) ||
+        nla_put_u32(skb, PROC_INFO_ATTR_UID, record->uid) ||
+        nla_put_u32(skb, PROC_INFO_ATTR_STATE, record->state) ||
+        nla_put_u8(skb, PROC_INFO_ATTR_STATE_CHAR, get_state_char(record->state_index)) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_RSS, record->memory_usage, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_RSS_ANON, record->rss_anon, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_RSS_FILE, record->rss_file, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_RSS_SHMEM, record->rss_shmem, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_VM_SIZE, record->vm_size, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_TIMESTAMP, record->timestamp, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_UTIME, record->utime, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_STIME, record->stime, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_START_TIME, record->start_time, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_NVCSW, record->nvcsw, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_NIVCSW, record->nivcsw, PROC_INFO_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PROC_INFO_ATTR_RUN_DELAY, record->run_delay, PROC_INFO_ATTR_PAD) ||
+        (record->pattern && nla_put_u16(skb, PROC_INFO_ATTR_PATTERN, record->pattern)))
+        goto cancel;
+
+    nla_nest_end(skb, nest);
+    return 0;
+
+cancel:
+    nla_nest_cancel(skb, nest);
+    return -EMSGSIZE;
+}
+
+/**
+ * Measure the cost of formatting process records.
+ *
+ * This function formats copies of the record of the calling process one at a time into a buffer
+ * of one record, the way show_proc formats a query, and stores the total size and elapsed time in
+ * the run.
+ *
+ * @bench: Pointer to the benchmark run to measure.
+ */
+static void run_format_benchmark(struct proc_info_bench *bench)
+{
+    struct proc_info_record record;
+    char text[PROC_RECORD_MAX];
+    struct proc_info_cursor cursor = { .buf = text, .len = 0, .size = sizeof(text) };
+    u64 start;
+    size_t i;
+
+    rcu_read_lock();
+    fill_process_record(current, &record);
+    rcu_read_unlock();
+
+    bench->bytes = 0;
+    start = ktime_get_ns();
+    for (i = 0; i < bench->nr_records; i++) {
+        cursor.len = 0;
+        log_process_info(&cursor, &record);
+        bench->bytes += cursor.len;
+    }
+    bench->elapsed = ktime_get_ns() - start;
+}
+
+/**
+ * Log the result of a formatting benchmark run.
+ *
+ * @cursor: Pointer to the cursor of the buffer to log the result to.
+ * @bench: Pointer to the benchmark run.
+ */
+static void log_format_benchmark(struct proc_info_cursor *cursor, const struct proc_info_bench *bench)
+{
+    cursor_printf(cursor, "Benchmark: %zu records (%zu bytes) formatted in %llu ns, %llu ns/record\n",
+                  bench->nr_records, bench->bytes, bench->elapsed,
+                  div_u64(bench->elapsed, bench->nr_records));
+}
+
+/**
+ * Check if a query asks for any process records.
+ *
+ * @query: Pointer to the query to check.
+ *
+ * @return: true if reading the query produces records, false if it only runs benchmarks or is
+ *          empty.
+ */
+static bool query_has_targets(const struct proc_info_query *query)
+{
+    return query->snapshot || query->tree || query->threads || query->nr_pids + query->nr_names > 0;
+}
+
+/**
+ * Reserve a records array.
+ *
+ * Arrays of up to PROC_POOL_RECORDS records are taken from the pool of the current CPU, and
+ * only allocated if it is empty. Larger arrays are allocated.
+ *
+ * @capacity: Pointer to the number of records needed, raised to the size of the array.
+ *
+ * @return: The array, or NULL on failure.
+ */
+static struct proc_info_record *get_record_buffer(size_t *capacity)
+{
+    struct proc_info_record *records;
+
+    if (*capacity > PROC_POOL_RECORDS) {
+        atomic_long_inc(&proc_pool_stats.oversized);
+        return kvmalloc_array(*capacity, sizeof(*records), GFP_KERNEL);
+    }
+
+    *capacity = PROC_POOL_RECORDS;
+    records = this_cpu_xchg(proc_record_pool, NULL);
+    if (records) {
+        atomic_long_inc(&proc_pool_stats.hits);
+        return records;
+    }
+    atomic_long_inc(&proc_pool_stats.misses);
+    return kvmalloc_array(PROC_POOL_RECORDS, sizeof(*records), GFP_KERNEL);
+}
+
+/**
+ * Release a records array from get_record_buffer().
+ *
+ * A pool sized array refills the pool of the current CPU if it is empty, and is freed otherwise.
+ *
+ * @records: The array, or NULL.
+ * @capacity: Number of records the array can hold.
+ */
+static void put_record_buffer(struct proc_info_record *records, size_t capacity)
+{
+    if (records && capacity == PROC_POOL_RECORDS &&
+        this_cpu_cmpxchg(proc_record_pool, NULL, records) == NULL)
+        return;
+    kvfree(records);
+}
+
+/**
+ * Fill the pool of records arrays of every CPU.
+ *
+ * A CPU whose array cannot be allocated starts with an empty pool and allocates on demand.
+ */
+static void record_pool_init(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        per_cpu(proc_record_pool, cpu) = kvmalloc_array(PROC_POOL_RECORDS,
+                                                         sizeof(struct proc_info_record), GFP_KERNEL);
+}
+
+/**
+ * Free the pool of records arrays of every CPU.
+ */
+static void record_pool_exit(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kvfree(per_cpu(proc_record_pool, cpu));
+        per_cpu(proc_record_pool, cpu) = NULL;
+    }
+}
+
+/**
+ * Free the compiled names of a query.
+ *
+ * @matcher: Pointer to the compiled names to clear.
+ */
+static void free_name_matcher(struct proc_name_matcher *matcher)
+{
+    kfree(matcher->patterns);
+    kfree(matcher->buckets);
+    kfree(matcher->wild);
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+/**
+ * Compile the process names of a query.
+ *
+ * Every name is sorted into an exact name, a prefix or a glob, and the exact names are chained
+ * into hash buckets. A query is compiled once, later calls return at once.
+ *
+ * @query: Pointer to the query whose names are compiled.
+ *
+ * @return: 0 on success, or -ENOMEM on failure.
+ */
+static int compile_name_matcher(struct proc_info_query *query)
+{
+    struct proc_name_matcher *matcher = &query->matcher;
+    struct proc_name_pattern *pattern;
+    size_t i, nr_exact = 0;
+    const char *meta;
+    u32 bucket;
+
+    if (matcher->patterns || !query->nr_names)
+        return 0;
+
+    matcher->patterns = kmalloc_array(query->nr_names, sizeof(*matcher->patterns), GFP_KERNEL);
+    matcher->wild = kmalloc_array(query->nr_names, sizeof(*matcher->wild), GFP_KERNEL);
+    if (!matcher->patterns || !matcher->wild)
+        goto fail;
+
+    for (i = 0; i < query->nr_names; i++) {
+        pattern = &matcher->patterns[i];
+        pattern->next = -1;
+        meta = strpbrk(query->names[i], "*?[");
+        if (!meta) {
+            pattern->kind = PROC_PATTERN_EXACT;
+            nr_exact++;
+            continue;
+        }
+        // A single trailing '*' is compared as a prefix instead of running the glob matcher
+        if (meta[0] == '*' && meta[1] == '\0') {
+            pattern->kind = PROC_PATTERN_PREFIX;
+            pattern->prefix_len = meta - query->names[i];
+        } else {
+            pattern->kind = PROC_PATTERN_GLOB;
+        }
+        matcher->wild[matcher->nr_wild++] = i;
+    }
+
+    if (nr_exact) {
+        matcher->nr_buckets = roundup_pow_of_two(nr_exact);
+        matcher->buckets = kmalloc_array(matcher->nr_buckets, sizeof(*matcher->buckets),
+                                         GFP_KERNEL);
+        if (!matcher->buckets)
+            goto fail;
+        for (bucket = 0; bucket < matcher->nr_buckets; bucket++)
+            matcher->buckets[bucket] = -1;
+        // Names are chained from the last one, so every bucket lists its names in query order
+        for (i = query->nr_names; i-- > 0; ) {
+            pattern = &matcher->patterns[i];
+            if (pattern->kind != PROC_PATTERN_EXACT)
+                continue;
+            bucket = hash_comm(query->names[i]) & (matcher->nr_buckets - 1);
+            pattern->next = matcher->buckets[bucket];
+            matcher->buckets[bucket] = i;
+        }
+    }
+    return 0;
+
+fail:
+    free_name_matcher(matcher);
+    return -ENOMEM;
+}
+
+/**
+ * Free the targets and records of a query.
+ *
+ * @query: Pointer to the query to clear.
+ */
+static void free_query_targets(struct proc_info_query *query)
+{
+    put_record_buffer(query->records, query->records_capacity);
+    kfree(query->matches);
+    free_name_matcher(&query->matcher);
+    query->records = NULL;
+    query->records_capacity = 0;
+    query->matches = NULL;
+    query->nr_records = 0;
+    kfree(query->pids);
+    kfree(query->names);
+    kfree(query->bench);
+    query->pids = NULL;
+    query->names = NULL;
+    query->bench = NULL;
+    query->nr_pids = 0;
+    query->nr_names = 0;
+    query->nr_bench = 0;
+}
+
+/**
+ * Parse a memory threshold of a filter.
+ *
+ * @text: A number of KB like the output, or of bytes with a K, M or G suffix as taken by memparse.
+ * @kb: Pointer to store the threshold in KB.
+ *
+ * @return: 0 on success, or -EINVAL if the text is not a memory size.
+ */
+static int parse_memory_kb(const char *text, unsigned long *kb)
+{
+    unsigned long long value;
+    char *end;
+
+    value = memparse(text, &end);
+    if (end == text || *end != '\0')
+        return -EINVAL;
+    *kb = isdigit(end[-1]) ? value : value >> 10;
+    return 0;
+}
+
+/**
+ * Parse the states accepted by a filter.
+ *
+ * @text: One or more state letters as shown by ps, such as "R" or "RD".
+ * @states: Pointer to the bit mask of state indexes to add the states to.
+ *
+ * @return: 0 on success, or -EINVAL on an unknown letter.
+ */
+static int parse_states(const char *text, unsigned int *states)
+{
+    size_t i;
+
+    if (*text == '\0')
+        return -EINVAL;
+    for (; *text; text++) {
+        for (i = 0; i < ARRAY_SIZE(proc_task_states); i++) {
+            if (proc_task_states[i].letter == *text)
+                break;
+        }
+        if (i == ARRAY_SIZE(proc_task_states))
+            return -EINVAL;
+        *states |= BIT(i);
+    }
+    return 0;
+}
+
+/**
+ * Compare two records by resident memory, for the heap of a top-N query.
+ *
+ * @lhs: Pointer to the first record.
+ * @rhs: Pointer to the second record.
+ *
+ * @return: true if the first record ranks lower.
+ */
+static bool less_rss(const void *lhs, const void *rhs)
+{
+    return ((const struct proc_info_record *)lhs)->memory_usage <
+           ((const struct proc_info_record *)rhs)->memory_usage;
+}
+
+/**
+ * Compare two records by virtual memory size, for the heap of a top-N query.
+ *
+ * @lhs: Pointer to the first record.
+ * @rhs: Pointer to the second record.
+ *
+ * @return: true if the first record ranks lower.
+ */
+static bool less_vm(const void *lhs, const void *rhs)
+{
+    return ((const struct proc_info_record *)lhs)->vm_size <
+           ((const struct proc_info_record *)rhs)->vm_size;
+}
+
+/**
+ * Compare two records by user and system CPU time, for the heap of a top-N query.
+ *
+ * @lhs: Pointer to the first record.
+ * @rhs: Pointer to the second record.
+ *
+ * @return: true if the first record ranks lower.
+ */
+static bool less_cpu(const void *lhs, const void *rhs)
+{
+    const struct proc_info_record *l = lhs, *r = rhs;
+
+    return l->utime + l->stime < r->utime + r->stime;
+}
+
+/**
+ * Swap two records in the heap of a top-N query.
+ *
+ * @lhs: Pointer to the first record.
+ * @rhs: Pointer to the second record.
+ */
+static void swap_records(void *lhs, void *rhs)
+{
+    swap(*(struct proc_info_record *)lhs, *(struct proc_info_record *)rhs);
+}
+
+/*
+ * Rankings of top-N queries, indexed by proc_info_query.top_key.
+ *
+ * The heap keeps the N highest records seen so far with the lowest of them at its root, so every
+ * further process costs one comparison with the root and only a winner costs log N swaps.
+ */
+static const struct {
+    const char *name;
+    struct min_heap_callbacks callbacks;
+} proc_top_keys[] = {
+    { "rss", { sizeof(struct proc_info_record), less_rss, swap_records } },
+    { "vm", { sizeof(struct proc_info_record), less_vm, swap_records } },
+    { "cpu", { sizeof(struct proc_info_record), less_cpu, swap_records } },
+};
+
+/**
+ * Parse the ranking of a top-N query.
+ *
+ * @text: Name of the ranking in proc_top_keys.
+ * @key: Pointer to store the index of the ranking.
+ *
+ * @return: 0 on success, or -EINVAL on an unknown ranking.
+ */
+static int parse_top_key(const char *text, unsigned int *key)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(proc_top_keys); i++) {
+        if (strcmp(text, proc_top_keys[i].name) == 0) {
+            *key = i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+/**
+ * Parse a query written to the /proc file.
+ *
+ * This function splits the input into whitespace separated items and the values of "pids=",
+ * "names=" and "bench=" items into comma separated targets. A query with an "interval=" item
+ * configures the sampler: it needs targets for a non-zero interval and none for 0. The input
+ * buffer is modified while parsing.
+ *
+ * @input: NUL terminated query text.
+ * @query: Pointer to the query to fill. Its target arrays must be empty.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int parse_query(char *input, struct proc_info_query *query)
+{
+    size_t max_targets = 1;
+    char *item, *value, *target;
+    const char *p;
+    unsigned long bench_records, bench_total = 0;
+    int pid;
+
+    // Every target is followed by a separator, which bounds the number of targets
+    for (p = input; *p; p++) {
+        if (*p == ',' || isspace(*p))
+            max_targets++;
+    }
+    if (max_targets > PROC_MAX_TARGETS)
+        max_targets = PROC_MAX_TARGETS;
+
+    query->pids = kmalloc_array(max_targets, sizeof(*query->pids), GFP_KERNEL);
+    query->names = kmalloc_array(max_targets, sizeof(*query->names), GFP_KERNEL);
+    query->bench = kmalloc_array(max_targets, sizeof(*query->bench), GFP_KERNEL);
+    if (!query->pids || !query->names || !query->bench)
+        return -ENOMEM;
+
+    while ((item = strsep(&input, " \t\n")) != NULL) {
+        if (*item == '\0')
+            continue;
+
+        value = strchr(item, '=');
+        if (!value)
+            return -EINVAL;
+        *value++ = '\0';
+
+        while ((target = strsep(&value, ",")) != NULL) {
+            if (query->nr_pids + query->nr_names + query->nr_bench >= PROC_MAX_TARGETS)
+                return -E2BIG;
+
+            if (strcmp(item, "pid") == 0 || strcmp(item, "pids") == 0) {
+                if (kstrtoint(target, 10, &pid) || pid < 0)
+                    return -EINVAL;
+                query->pids[query->nr_pids++] = pid;
+            } else if (strcmp(item, "name") == 0 || strcmp(item, "names") == 0) {
+                if (*target == '\0' ||
+                    strscpy(query->names[query->nr_names], target, TASK_COMM_LEN) < 0)
+                    return -EINVAL;
+                query->nr_names++;
+            } else if (strcmp(item, "bench") == 0) {
+                // The runs of a query are bounded, any user may write one
+                if (kstrtoul(target, 10, &bench_records) || bench_records == 0 ||
+                    bench_records > PROC_BENCH_MAX || query->nr_bench == PROC_BENCH_RUNS_MAX ||
+                    bench_total + bench_records > PROC_BENCH_TOTAL_MAX)
+                    return -EINVAL;
+                bench_total += bench_records;
+                memset(&query->bench[query->nr_bench], 0, sizeof(*query->bench));
+                query->bench[query->nr_bench++].nr_records = bench_records;
+            } else if (strcmp(item, "format") == 0) {
+                if (strcmp(target, "binary") == 0)
+                    query->binary = true;
+                else if (strcmp(target, "text") == 0)
+                    query->binary = false;
+                else
+                    return -EINVAL;
+            } else if (strcmp(item, "mode") == 0) {
+                if (strcmp(target, "snapshot") == 0)
+                    query->snapshot = true;
+                else if (strcmp(target, "query") == 0)
+                    query->snapshot = false;
+                else
+                    return -EINVAL;
+            } else if (strcmp(item, "tree") == 0) {
+                if (query->tree || kstrtoint(target, 10, &query->tree_root) || query->tree_root < 0)
+                    return -EINVAL;
+                query->tree = true;
+            } else if (strcmp(item, "threads") == 0) {
+                if (query->threads || kstrtoint(target, 10, &query->threads_pid) ||
+                    query->threads_pid < 0)
+                    return -EINVAL;
+                query->threads = true;
+            } else if (strcmp(item, "interval") == 0) {
+                if (kstrtouint(target, 10, &query->interval_ms) ||
+                    query->interval_ms > PROC_SAMPLE_INTERVAL_MAX)
+                    return -EINVAL;
+                query->sample = true;
+            } else if (strcmp(item, "ring") == 0) {
+                if (strcmp(target, "shared") == 0)
+                    query->shared = true;
+                else if (strcmp(target, "percpu") == 0)
+                    query->shared = false;
+                else
+                    return -EINVAL;
+            } else if (strcmp(item, "match") == 0) {
+                if (strcmp(target, "all") == 0)
+                    query->all_matches = true;
+                else if (strcmp(target, "first") == 0)
+                    query->all_matches = false;
+                else
+                    return -EINVAL;
+            } else if (strcmp(item, "uid") == 0) {
+                if (kstrtouint(target, 10, &query->filter.uid))
+                    return -EINVAL;
+                query->filter.has_uid = true;
+            } else if (strcmp(item, "ppid") == 0) {
+                if (kstrtoint(target, 10, &query->filter.ppid) || query->filter.ppid < 0)
+                    return -EINVAL;
+                query->filter.has_ppid = true;
+            } else if (strcmp(item, "state") == 0) {
+                if (parse_states(target, &query->filter.states))
+                    return -EINVAL;
+            } else if (strcmp(item, "min_rss") == 0) {
+                if (parse_memory_kb(target, &query->filter.min_rss))
+                    return -EINVAL;
+                query->filter.has_min_rss = true;
+            } else if (strcmp(item, "max_rss") == 0) {
+                if (parse_memory_kb(target, &query->filter.max_rss))
+                    return -EINVAL;
+                query->filter.has_max_rss = true;
+            } else if (strcmp(item, "kthread") == 0) {
+                if (kstrtobool(target, &query->filter.kthread))
+                    return -EINVAL;
+                query->filter.has_kthread = true;
+            } else if (strcmp(item, "key") == 0) {
+                if (parse_top_key(target, &query->top_key))
+                    return -EINVAL;
+            } else if (strcmp(item, "topn") == 0 && strncmp(target, "key=", 4) == 0) {
+                // The ranking may follow the count as "topn=<N>,key=<KEY>"
+                if (parse_top_key(target + 4, &query->top_key))
+                    return -EINVAL;
+            } else if (strcmp(item, "topn") == 0) {
+                if (query->top_n || kstrtouint(target, 10, &query->top_n) || query->top_n == 0 ||
+                    query->top_n > PROC_TOP_MAX)
+                    return -EINVAL;
+                query->snapshot = true;
+            } else {
+                return -EINVAL;
+            }
+
+            // The singular forms take exactly one target
+            if (value && (strcmp(item, "pid") == 0 || strcmp(item, "name") == 0 ||
+                          strcmp(item, "tree") == 0 || strcmp(item, "threads") == 0 ||
+                          strcmp(item, "interval") == 0 || strcmp(item, "uid") == 0 ||
+                          strcmp(item, "ppid") == 0 || strcmp(item, "min_rss") == 0 ||
+                          strcmp(item, "max_rss") == 0 || strcmp(item, "kthread") == 0 ||
+                          strcmp(item, "key") == 0))
+                return -EINVAL;
+        }
+    }
+
+    // Filters only narrow down snapshots
+    query->filter.active = query->filter.has_uid || query->filter.has_ppid || query->filter.states ||
+                           query->filter.has_min_rss || query->filter.has_max_rss ||
+                           query->filter.has_kthread;
+    if (query->filter.active && !query->snapshot)
+        return -EINVAL;
+    if (query->top_n && !query->snapshot)
+        return -EINVAL;
+
+    // A snapshot, a subtree and a thread list are the whole query, so they take no other targets
+    if (query->snapshot + query->tree + query->threads > 1)
+        return -EINVAL;
+    if ((query->snapshot || query->tree || query->threads) && query->nr_pids + query->nr_names > 0)
+        return -EINVAL;
+    // A sampler needs targets to start and none to stop, and does not run benchmarks
+    if (query->sample && (query->nr_bench || query_has_targets(query) != (query->interval_ms > 0)))
+        return -EINVAL;
+    if (query->shared && !query->sample)
+        return -EINVAL;
+    if (!query->sample && !query_has_targets(query) && query->nr_bench == 0)
+        return -EINVAL;
+    return 0;
+}
+
+/**
+ * Find the index entry of a thread group.
+ *
+ * This function must be called with proc_index_lock held.
+ *
+ * @tgid: The thread group to look up.
+ *
+ * @return: The entry, or NULL if the thread group is not indexed.
+ */
+static struct proc_index_entry *find_index_entry(struct pid *tgid)
+{
+    struct proc_index_entry *entry;
+
+    hash_for_each_possible(proc_index_by_tgid, entry, by_tgid, (unsigned long)tgid) {
+        if (entry->tgid == tgid)
+            return entry;
+    }
+    return NULL;
+}
+
+/**
+ * RCU callback freeing an index entry once no reader can see it.
+ *
+ * @rcu: The rcu_head of the entry.
+ */
+static void free_index_entry_rcu(struct rcu_head *rcu)
+{
+    struct proc_index_entry *entry = container_of(rcu, struct proc_index_entry, rcu);
+
+    put_pid(entry->tgid);
+    kfree(entry);
+}
+
+/**
+ * Remove an entry from the process index.
+ *
+ * This function must be called with proc_index_lock held.
+ *
+ * @entry: The entry to remove.
+ */
+static void remove_index_entry(struct proc_index_entry *entry)
+{
+    hash_del_rcu(&entry->by_name);
+    hash_del(&entry->by_tgid);
+    atomic_long_dec(&proc_index_stats.entries);
+    call_rcu(&entry->rcu, free_index_entry_rcu);
+}
+
+/**
+ * Add a process to the process index, or refresh its name.
+ *
+ * A renamed process gets a new entry, so readers never see a name change half way.
+ * This function must be called with proc_index_lock held.
+ *
+ * @task: The thread group leader of the process.
+ */
+static void update_index_entry(struct task_struct *task)
+{
+    struct pid *tgid = task_tgid(task);
+    struct proc_index_entry *entry, *old;
+
+    old = find_index_entry(tgid);
+    if (old && strncmp(old->comm, task->comm, TASK_COMM_LEN) == 0)
+        return;
+
+    entry = kmalloc(sizeof(*entry), GFP_ATOMIC);
+    if (!entry) {
+        // A stale entry could hide the process from name queries, so drop it
+        atomic_long_inc(&proc_index_stats.failures);
+        if (old)
+            remove_index_entry(old);
+        return;
+    }
+
+    entry->tgid = get_pid(tgid);
+    memcpy(entry->comm, task->comm, TASK_COMM_LEN);
+    entry->comm[TASK_COMM_LEN - 1] = '\0';
+    if (old)
+        remove_index_entry(old);
+    hash_add_rcu(proc_index_by_name, &entry->by_name, hash_comm(entry->comm));
+    hash_add(proc_index_by_tgid, &entry->by_tgid, (unsigned long)tgid);
+    atomic_long_inc(&proc_index_stats.entries);
+}
+
+/**
+ * Apply one change of a process to the process index and account for its cost.
+ *
+ * @task: The thread group leader of the changed process, or any thread of an exiting one.
+ * @remove: Whether the process exited instead of being created or renamed.
+ *
+ * @return: false if the process was to be removed but had no entry, true otherwise.
+ */
+static bool track_process(struct task_struct *task, bool remove)
+{
+    struct proc_index_entry *entry = NULL;
+    u64 start = local_clock();
+
+    spin_lock(&proc_index_lock);
+    if (!remove) {
+        update_index_entry(task);
+    } else {
+        entry = find_index_entry(task_tgid(task));
+        if (entry)
+            remove_index_entry(entry);
+    }
+    spin_unlock(&proc_index_lock);
+
+    atomic_long_inc(&proc_index_stats.updates);
+    atomic64_add(local_clock() - start, &proc_index_stats.update_ns);
+    return !remove || entry;
+}
+
+/**
+ * Record a process event in the ring of the current CPU.
+ *
+ * Nothing is recorded while no events file is open. This function is called from the tracepoint
+ * probes, with preemption disabled, so it only takes the ring of its CPU and never sleeps.
+ *
+ * @type: PROC_INFO_EVENT_* type of the event.
+ * @task: The thread group leader of a new process, or the thread that removed an exiting process
+ *        from the index.
+ */
+static void record_event(unsigned int type, struct task_struct *task)
+{
+    struct proc_event_ring *ring;
+    struct proc_info_event *event;
+    unsigned long head;
+
+    if (!atomic_read(&proc_events.readers))
+        return;
+
+    // The count of readers is read unordered, so the slots of this CPU may not be visible yet
+    ring = get_cpu_ptr(&proc_event_rings);
+    head = ring->head;
+    if (!READ_ONCE(ring->slots)) {
+        put_cpu_ptr(&proc_event_rings);
+        return;
+    }
+    // Pairs with the release of tail in read_events, the slot is free once the reader moved past it
+    if (head - smp_load_acquire(&ring->tail) >= PROC_EVENT_SLOTS) {
+        WRITE_ONCE(ring->dropped, ring->dropped + 1);
+        put_cpu_ptr(&proc_event_rings);
+        return;
+    }
+
+    event = &ring->slots[head & (PROC_EVENT_SLOTS - 1)];
+    event->timestamp = ktime_get_ns();
+    event->type = type;
+    event->pid = task->tgid;
+    rcu_read_lock();
+    event->ppid = rcu_dereference(task->real_parent)->tgid;
+    rcu_read_unlock();
+    event->lost = 0;
+    // The exiting thread may not be the leader, the name of a process is the name of its leader
+    memcpy(event->comm, task->group_leader->comm, TASK_COMM_LEN);
+    if (type == PROC_INFO_EVENT_EXIT) {
+        // The address space is already released, do_exit folded its high water mark into maxrss
+        event->peak_rss = READ_ONCE(task->signal->maxrss) << (PAGE_SHIFT - 10);
+        event->exit_code = task->exit_code;
+    } else {
+        // A new process or program runs on an address space that cannot be released meanwhile
+        event->peak_rss = task->mm ? get_mm_hiwater_rss(task->mm) << (PAGE_SHIFT - 10) : 0;
+        event->exit_code = 0;
+    }
+    smp_store_release(&ring->head, head + 1);
+    put_cpu_ptr(&proc_event_rings);
+
+    atomic_long_inc(&proc_events.recorded);
+    if (wq_has_sleeper(&proc_event_wait))
+        wake_up_interruptible(&proc_event_wait);
+}
+
+/**
+ * Probe of the sched_process_fork tracepoint.
+ *
+ * New processes are added to the index and recorded as events; new threads belong to an indexed
+ * process already.
+ *
+ * @data: Unused probe data.
+ * @parent: The forking task.
+ * @child: The new task.
+ */
+static void probe_process_fork(void *data, struct task_struct *parent, struct task_struct *child)
+{
+    if (thread_group_leader(child)) {
+        track_process(child, false);
+        record_event(PROC_INFO_EVENT_FORK, child);
+    }
+}
+
+/**
+ * Probe of the sched_process_exec tracepoint.
+ *
+ * Exec renames the process to the new program, and the exec'ing task is the thread group
+ * leader by the time the tracepoint fires.
+ *
+ * @data: Unused probe data.
+ * @task: The task that executed a new program.
+ * @old_pid: The PID of the task before exec.
+ * @bprm: The binary that was executed.
+ */
+static void probe_process_exec(void *data, struct task_struct *task, pid_t old_pid,
+                               struct linux_binprm *bprm)
+{
+    track_process(task, false);
+    record_event(PROC_INFO_EVENT_EXEC, task);
+}
+
+/**
+ * Probe of the sched_process_exit tracepoint.
+ *
+ * The process leaves the index when its last thread exits, not when its leader does. do_exit
+ * drops signal->live well before this tracepoint, so several threads exiting together may all
+ * see it at 0; only the one that removes the index entry records the exit.
+ *
+ * @data: Unused probe data.
+ * @task: The exiting task.
+ */
+static void probe_process_exit(void *data, struct task_struct *task)
+{
+    if (atomic_read(&task->signal->live) == 0 && track_process(task, true))
+        record_event(PROC_INFO_EVENT_EXIT, task);
+}
+
+/*
+ * Tracepoints hooked by the module. Scheduler tracepoints are not exported to modules by name,
+ * so they are looked up with for_each_kernel_tracepoint when the module is loaded.
+ */
+static struct proc_info_tracepoint {
+    const char *name;
+    void *probe;
+    struct tracepoint *tp;
+    bool registered;
+} proc_tracepoints[] = {
+    { .name = "sched_process_fork", .probe = probe_process_fork },
+    { .name = "sched_process_exec", .probe = probe_process_exec },
+    { .name = "sched_process_exit", .probe = probe_process_exit },
+};
+
+/**
+ * Callback of for_each_kernel_tracepoint matching the hooked tracepoints by name.
+ *
+ * @tp: A tracepoint of the kernel.
+ * @priv: Unused.
+ */
+static void lookup_tracepoint(struct tracepoint *tp, void *priv)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(proc_tracepoints); i++) {
+        if (strcmp(tp->name, proc_tracepoints[i].name) == 0)
+            proc_tracepoints[i].tp = tp;
+    }
+}
+
+/**
+ * Unhook the tracepoints and empty the process index.
+ */
+static void process_index_exit(void)
+{
+    struct proc_index_entry *entry;
+    struct hlist_node *tmp;
+    size_t i;
+    int bkt;
+
+    for (i = 0; i < ARRAY_SIZE(proc_tracepoints); i++) {
+        if (proc_tracepoints[i].registered)
+            tracepoint_probe_unregister(proc_tracepoints[i].tp, proc_tracepoints[i].probe, NULL);
+        proc_tracepoints[i].registered = false;
+    }
+    tracepoint_synchronize_unregister();
+    proc_index_ready = false;
+
+    spin_lock(&proc_index_lock);
+    hash_for_each_safe(proc_index_by_tgid, bkt, tmp, entry, by_tgid)
+        remove_index_entry(entry);
+    spin_unlock(&proc_index_lock);
+
+    // Wait for the entries queued to call_rcu, their callback is module code
+    rcu_barrier();
+}
+
+/**
+ * Hook the fork/exec/exit tracepoints and fill the process index with the running processes.
+ *
+ * The hooks are registered before the task list is walked, so no process created meanwhile is
+ * missed; processes seen by both are only indexed once.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int process_index_init(void)
+{
+    struct task_struct *task;
+    size_t i;
+    int err;
+
+    for_each_kernel_tracepoint(lookup_tracepoint, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(proc_tracepoints); i++) {
+        if (!proc_tracepoints[i].tp) {
+            printk(KERN_ERR "Tracepoint %s not found\n", proc_tracepoints[i].name);
+            err = -ENOENT;
+            goto fail;
+        }
+        err = tracepoint_probe_register(proc_tracepoints[i].tp, proc_tracepoints[i].probe, NULL);
+        if (err)
+            goto fail;
+        proc_tracepoints[i].registered = true;
+    }
+
+    rcu_read_lock();
+    spin_lock(&proc_index_lock);
+    for_each_process(task)
+        update_index_entry(task);
+    spin_unlock(&proc_index_lock);
+    rcu_read_unlock();
+
+    proc_index_ready = true;
+    return 0;
+
+fail:
+    process_index_exit();
+    return err;
+}
+
+/**
+ * Count the events dropped by all rings.
+ *
+ * @return: Number of events dropped since the module was loaded.
+ */
+static unsigned long events_dropped(void)
+{
+    unsigned long dropped = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        dropped += READ_ONCE(per_cpu_ptr(&proc_event_rings, cpu)->dropped);
+    return dropped;
+}
+
+/**
+ * Show callback function of the statistics /proc file.
+ *
+ * @m: Pointer to the seq_file of the statistics /proc file.
+ * @v: Unused.
+ *
+ * @return: Always 0.
+ */
+static int show_stats(struct seq_file *m, void *v)
+{
+    long lookups = atomic_long_read(&proc_index_stats.lookups);
+    long hits = atomic_long_read(&proc_index_stats.hits);
+    long updates = atomic_long_read(&proc_index_stats.updates);
+    u64 update_ns = atomic64_read(&proc_index_stats.update_ns);
+    unsigned long sample_dropped = 0;
+    int cpu;
+
+    seq_printf(m, "Index enabled: %s\n", proc_index_ready && READ_ONCE(use_index) ? "yes" : "no");
+    seq_printf(m, "Index entries: %ld\n", atomic_long_read(&proc_index_stats.entries));
+    seq_printf(m, "Index lookups: %ld\n", lookups);
+    seq_printf(m, "Index hits: %ld\n", hits);
+    seq_printf(m, "Index misses: %ld\n", lookups - hits);
+    seq_printf(m, "Index hit rate: %ld%%\n", lookups ? hits * 100 / lookups : 0);
+    seq_printf(m, "Index updates: %ld\n", updates);
+    seq_printf(m, "Index update failures: %ld\n", atomic_long_read(&proc_index_stats.failures));
+    seq_printf(m, "Index update time: %llu ns, %llu ns/update\n", update_ns,
+               updates ? div64_u64(update_ns, updates) : 0);
+
+    for_each_possible_cpu(cpu)
+        sample_dropped += READ_ONCE(per_cpu_ptr(&proc_sample_rings, cpu)->dropped);
+    seq_printf(m, "Record pool: %ld hits, %ld misses, %ld oversized\n",
+               atomic_long_read(&proc_pool_stats.hits), atomic_long_read(&proc_pool_stats.misses),
+               atomic_long_read(&proc_pool_stats.oversized));
+    seq_printf(m, "Sampler interval: %u ms\n", jiffies_to_msecs(READ_ONCE(proc_sampler.interval)));
+    seq_printf(m, "Sampler passes: %ld\n", atomic_long_read(&proc_sampler.passes));
+    seq_printf(m, "Sampler late passes: %ld\n", atomic_long_read(&proc_sampler.late));
+    seq_printf(m, "Samples recorded: %ld\n", atomic_long_read(&proc_sampler.samples));
+    seq_printf(m, "Samples dropped: %lu ring full, %lu shared ring full, %ld pass overflow\n",
+               sample_dropped, READ_ONCE(proc_sampler.shared_dropped),
+               atomic_long_read(&proc_sampler.overflows));
+    seq_printf(m, "Event readers: %d\n", atomic_read(&proc_events.readers));
+    seq_printf(m, "Events recorded: %ld\n", atomic_long_read(&proc_events.recorded));
+    seq_printf(m, "Events dropped: %lu\n", events_dropped());
+    return 0;
+}
+
+/**
+ * Find the depth of a process below the root of a subtree.
+ *
+ * The children lists are protected by tasklist_lock, which modules cannot take, and may be
+ * modified under a walker holding only RCU. The ancestry is followed through real_parent
+ * instead, which is safe under RCU and ends at the idle task, its own parent.
+ *
+ * @task: The process to look at. Must be called under rcu_read_lock.
+ * @root: The root of the subtree.
+ *
+ * @return: The number of generations between the process and the root, or -1 if the process
+ *          is not in the subtree.
+ */
+static int subtree_depth(struct task_struct *task, struct task_struct *root)
+{
+    struct task_struct *parent;
+    int depth = 0;
+
+    while (task->tgid != root->tgid) {
+        parent = rcu_dereference(task->real_parent);
+        if (parent == task || depth == PROC_TREE_DEPTH_MAX)
+            return -1;
+        task = parent;
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Estimate the number of processes visible to the caller.
+ *
+ * Every task holds a PID in the PID namespace of the caller, so the number of allocated PIDs
+ * bounds the number of processes from above without walking the task list.
+ *
+ * @return: Number of PIDs allocated in the PID namespace of the calling task.
+ */
+static size_t count_pids(void)
+{
+    return READ_ONCE(task_active_pid_ns(current)->pid_allocated) & ~PIDNS_ADDING;
+}
+
+/**
+ * Offer a record to the heap of a top-N query.
+ *
+ * The record is added while the heap has room, and replaces the lowest record once it is full if
+ * it ranks higher.
+ *
+ * @heap: Pointer to the heap.
+ * @record: Pointer to the record, copied into the heap.
+ * @callbacks: Ranking of the query.
+ */
+static void push_top_record(struct min_heap *heap, const struct proc_info_record *record,
+                            const struct min_heap_callbacks *callbacks)
+{
+    if (heap->nr < heap->size)
+        min_heap_push(heap, record, callbacks);
+    else if (callbacks->less(heap->data, record))
+        min_heap_pop_push(heap, record, callbacks);
+}
+
+/**
+ * Sort the heap of a top-N query in place, highest first.
+ *
+ * Popping the lowest record moves the last one to the root, so the popped record goes to the
+ * slot that was just freed at the end of the heap.
+ *
+ * @heap: Pointer to the heap.
+ * @callbacks: Ranking of the query.
+ * @spare: Pointer to a record to hold the popped one.
+ *
+ * @return: Number of records in the sorted array.
+ */
+static size_t sort_top_records(struct min_heap *heap, const struct min_heap_callbacks *callbacks,
+                               struct proc_info_record *spare)
+{
+    struct proc_info_record *records = heap->data;
+    size_t nr = heap->nr;
+
+    while (heap->nr > 1) {
+        *spare = records[0];
+        min_heap_pop(heap, callbacks);
+        records[heap->nr] = *spare;
+    }
+    return nr;
+}
+
+/**
+ * Check the predicates of a filter on a task, before its record is taken.
+ *
+ * This function must be called under rcu_read_lock().
+ *
+ * @filter: Pointer to the filter.
+ * @task: Pointer to the task structure of the process.
+ *
+ * @return: true if the task passes the predicates, false otherwise.
+ */
+static bool filter_task(const struct proc_info_filter *filter, struct task_struct *task)
+{
+    if (filter->has_kthread && !!(task->flags & PF_KTHREAD) != filter->kthread)
+        return false;
+    if (filter->has_uid && task_uid(task).val != filter->uid)
+        return false;
+    if (filter->has_ppid && (!task->parent || task->parent->pid != filter->ppid))
+        return false;
+    if (filter->states && !(filter->states & BIT(task_state_index(task))))
+        return false;
+    return true;
+}
+
+/**
+ * Check the memory thresholds of a filter on a record.
+ *
+ * @filter: Pointer to the filter.
+ * @record: Pointer to the record of the process.
+ *
+ * @return: true if the record passes the thresholds, false otherwise.
+ */
+static bool filter_record(const struct proc_info_filter *filter, const struct proc_info_record *record)
+{
+    if (filter->has_min_rss && record->memory_usage < filter->min_rss)
+        return false;
+    if (filter->has_max_rss && record->memory_usage > filter->max_rss)
+        return false;
+    return true;
+}
+
+/**
+ * Compare two records by the start time of their processes, for sort().
+ *
+ * Processes are added to the task list when they are created, so this is task list order.
+ *
+ * @lhs: Pointer to the first record.
+ * @rhs: Pointer to the second record.
+ *
+ * @return: A negative value, 0 or a positive value if the first process started earlier, at the
+ *          same time or later than the second one.
+ */
+static int compare_start_time(const void *lhs, const void *rhs)
+{
+    const struct proc_info_record *l = lhs, *r = rhs;
+
+    if (l->start_time != r->start_time)
+        return l->start_time < r->start_time ? -1 : 1;
+    return l->pid - r->pid;
+}
+
+/**
+ * Check if a process started before another one.
+ *
+ * Processes are ordered by start time, then by process ID, like the task list.
+ *
+ * @start: Start time of the first process.
+ * @pid: Process ID of the first process.
+ * @other_start: Start time of the second process.
+ * @other_pid: Process ID of the second process.
+ *
+ * @return: True if the first process comes before the second one.
+ */
+static bool started_before(u64 start, pid_t pid, u64 other_start, pid_t other_pid)
+{
+    return start < other_start || (start == other_start && pid < other_pid);
+}
+
+/**
+ * Find the previous occurrence of an exact process name in a query.
+ *
+ * Identical names are chained in the same bucket of the name matcher in query order, so only
+ * the names sharing the bucket are compared.
+ *
+ * @query: Query holding the compiled process names.
+ * @n: Index of the exact process name.
+ *
+ * @return: The match of the last earlier occurrence of the name, NULL if the name is not repeated.
+ */
+static struct proc_info_match *previous_duplicate(struct proc_info_query *query, size_t n)
+{
+    const struct proc_name_matcher *matcher = &query->matcher;
+    struct proc_info_match *prev = NULL;
+    int k;
+
+    k = matcher->buckets[hash_comm(query->names[n]) & (matcher->nr_buckets - 1)];
+    for (; k >= 0 && k < (int)n; k = matcher->patterns[k].next)
+        if (strcmp(query->names[k], query->names[n]) == 0)
+            prev = &query->matches[k];
+    return prev;
+}
+
+/**
+ * Retrieve the records of all targets of a query in one pass.
+ *
+ * All targets are resolved in a single RCU read-side critical section. Process IDs are looked
+ * up in the PID hash and process names in the process index; without the index all process
+ * names share one scan of the task list. Records that do not fit in the capacity are counted
+ * but not stored.
+ *
+ * @query: Pointer to the query to answer.
+ * @records: Array to store the records in.
+ * @capacity: Number of records the array can hold.
+ *
+ * @return: Number of records the query produced.
+ */
+static size_t collect_pass(struct proc_info_query *query, struct proc_info_record *records,
+                           size_t capacity)
+{
+    const struct min_heap_callbacks *top = &proc_top_keys[query->top_key].callbacks;
+    struct min_heap heap = { .data = records, .size = min_t(size_t, capacity, query->top_n) };
+    struct proc_info_record spare, *record;
+    struct proc_index_entry *entry;
+    struct proc_info_match *prev;
+    struct task_struct *task, *root, *oldest;
+    size_t i, nr = 0, first, found_names = 0;
+    int depth;
+
+    query->visited = 0;
+    query->matched = 0;
+    query->tree_count = 0;
+    query->tree_memory = 0;
+    query->thread_count = 0;
+    memset(query->matches, 0, query->nr_names * sizeof(*query->matches));
+
+    rcu_read_lock();
+    if (query->snapshot) {
+        for_each_process(task) {
+            query->visited++;
+            if (query->filter.active && !filter_task(&query->filter, task))
+                continue;
+            // A top-N query takes every record into the spare and offers it to the heap
+            record = nr < capacity && !query->top_n ? &records[nr] : &spare;
+            fill_process_record(task, record);
+            // A record failing the memory thresholds is overwritten by the next one
+            if (query->filter.active && !filter_record(&query->filter, record))
+                continue;
+            query->matched++;
+            if (query->top_n)
+                push_top_record(&heap, record, top);
+            else
+                nr++;
+        }
+        if (query->top_n)
+            nr = sort_top_records(&heap, top, &spare);
+    }
+
+    if (query->tree) {
+        // Every process is checked against the root, the subtree is in task list order
+        root = pid_task(find_vpid(query->tree_root), PIDTYPE_TGID);
+        if (root) {
+            for_each_process(task) {
+                query->visited++;
+                depth = subtree_depth(task, root);
+                if (depth < 0)
+                    continue;
+                record = nr < capacity ? &records[nr] : &spare;
+                nr++;
+                fill_process_record(task, record);
+                record->depth = depth;
+                query->tree_count++;
+                query->tree_memory += record->memory_usage;
+            }
+        } else {
+            record = nr < capacity ? &records[nr] : &spare;
+            nr++;
+            memset(record, 0, sizeof(*record));
+            record->pid = query->tree_root;
+        }
+    }
+
+    if (query->threads) {
+        // The thread list of a process is RCU protected, no lock is taken
+        root = pid_task(find_vpid(query->threads_pid), PIDTYPE_TGID);
+        if (root) {
+            for_each_thread(root, task) {
+                query->visited++;
+                record = nr < capacity ? &records[nr] : &spare;
+                nr++;
+                fill_thread_record(task, record);
+                query->thread_count++;
+            }
+        } else {
+            record = nr < capacity ? &records[nr] : &spare;
+            nr++;
+            memset(record, 0, sizeof(*record));
+            record->pid = query->threads_pid;
+        }
+    }
+
+    for (i = 0; i < query->nr_pids; i++) {
+        record = nr < capacity ? &records[nr] : &spare;
+        memset(record, 0, sizeof(*record));
+        nr++;
+        // PID queries resolve through the PID hash instead of walking every task
+        task = pid_task(find_vpid(query->pids[i]), PIDTYPE_TGID);
+        if (task) {
+            query->visited++;
+            fill_process_record(task, record);
+        } else {
+            record->pid = query->pids[i];
+        }
+    }
+
+    if (query->nr_names && !query->matcher.nr_wild && proc_index_ready && READ_ONCE(use_index)) {
+        // Exact name queries resolve through the process index and only visit processes with the name
+        for (i = 0; i < query->nr_names; i++) {
+            first = nr;
+            oldest = NULL;
+            prev = query->all_matches ? NULL : previous_duplicate(query, i);
+            // A repeated name takes the next process after its previous occurrence, like the scan
+            if (prev && !prev->count)
+                goto lookup_done;
+            hash_for_each_possible_rcu(proc_index_by_name, entry, by_name,
+                                       hash_comm(query->names[i])) {
+                if (strcmp(entry->comm, query->names[i]) != 0)
+                    continue;
+                query->visited++;
+                // The process may have exited or been renamed since it was indexed
+                task = pid_task(entry->tgid, PIDTYPE_TGID);
+                if (!task || strncmp(task->comm, query->names[i], TASK_COMM_LEN) != 0)
+                    continue;
+
+                // Buckets list the newest entries first, the scan reports the oldest process
+                if (!query->all_matches) {
+                    if (prev && !started_before(prev->start_time, prev->pid,
+                                                task->start_boottime, task_tgid_nr(task)))
+                        continue;
+                    if (!oldest || started_before(task->start_boottime, task_tgid_nr(task),
+                                                  oldest->start_boottime, task_tgid_nr(oldest)))
+                        oldest = task;
+                    continue;
+                }
+                record = nr < capacity ? &records[nr] : &spare;
+                nr++;
+                fill_process_record(task, record);
+                record->pattern = i + 1;
+                query->matches[i].count++;
+                query->matches[i].memory_usage += record->memory_usage;
+            }
+            if (oldest) {
+                record = nr < capacity ? &records[nr] : &spare;
+                nr++;
+                fill_process_record(oldest, record);
+                record->pattern = i + 1;
+                query->matches[i].count++;
+                query->matches[i].memory_usage += record->memory_usage;
+                query->matches[i].start_time = oldest->start_boottime;
+                query->matches[i].pid = task_tgid_nr(oldest);
+            }
+            // All matches are reported oldest first, in task list order like the scan
+            if (nr - first > 1 && nr <= capacity)
+                sort(&records[first], nr - first, sizeof(*records), compare_start_time, NULL);
+lookup_done:
+            atomic_long_inc(&proc_index_stats.lookups);
+            if (query->matches[i].count)
+                atomic_long_inc(&proc_index_stats.hits);
+        }
+    } else if (query->nr_names) {
+        // Without the index, or with a prefix or glob, all names share one scan of the task list
+        for_each_process(task) {
+            query->visited++;
+            if (get_process_info(task, query, &i) != 0)
+                continue;
+
+            record = nr < capacity ? &records[nr] : &spare;
+            nr++;
+            fill_process_record(task, record);
+            record->pattern = i + 1;
+            query->matches[i].count++;
+            query->matches[i].memory_usage += record->memory_usage;
+
+            if (!query->all_matches && ++found_names == query->nr_names)
+                break;
+        }
+    }
+    rcu_read_unlock();
+
+    // Names without any match are reported after the matches
+    for (i = 0; i < query->nr_names; i++) {
+        if (query->matches[i].count)
+            continue;
+        if (nr < capacity) {
+            memset(&records[nr], 0, sizeof(records[nr]));
+            memcpy(records[nr].comm, query->names[i], TASK_COMM_LEN);
+            records[nr].pattern = i + 1;
+        }
+        nr++;
+    }
+    return nr;
+}
+
+/**
+ * Estimate the number of records a query produces.
+ *
+ * @query: Pointer to the query to answer.
+ *
+ * @return: Number of records to reserve for the first pass.
+ */
+static size_t query_capacity(const struct proc_info_query *query)
+{
+    // Every process ID and, without match=all, every name produces exactly one record
+    if (query->top_n)
+        return query->top_n;
+    if (query->snapshot)
+        return count_pids() + PROC_RECORD_SLACK;
+    // The size of a subtree or thread list is only known after the pass, larger ones take a second pass
+    if (query->tree || query->threads)
+        return PROC_MATCHES_HINT;
+    if (query->all_matches)
+        return query->nr_pids + query->nr_names * PROC_MATCHES_HINT;
+    return query->nr_pids + query->nr_names;
+}
+
+/**
+ * Retrieve the records of all targets of a query.
+ *
+ * The number of tasks matching a name is not known before the scan. If the first pass finds more
+ * records than were reserved, the records are reserved again for the counted size and the pass
+ * is repeated; a task list that keeps outgrowing the reservation truncates the output.
+ *
+ * @query: Pointer to the query to answer.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int collect_records(struct proc_info_query *query)
+{
+    struct proc_info_record *records;
+    size_t capacity, nr;
+    int attempt, err;
+
+    put_record_buffer(query->records, query->records_capacity);
+    query->records = NULL;
+    query->records_capacity = 0;
+    query->nr_records = 0;
+    query->nr_dropped = 0;
+
+    err = compile_name_matcher(query);
+    if (err)
+        return err;
+    if (!query->matches && query->nr_names) {
+        query->matches = kcalloc(query->nr_names, sizeof(*query->matches), GFP_KERNEL);
+        if (!query->matches)
+            return -ENOMEM;
+    }
+
+    capacity = query_capacity(query);
+    for (attempt = 0; ; attempt++) {
+        records = get_record_buffer(&capacity);
+        if (!records)
+            return -ENOMEM;
+
+        nr = collect_pass(query, records, capacity);
+        if (nr <= capacity || attempt == PROC_COLLECT_RETRIES)
+            break;
+
+        put_record_buffer(records, capacity);
+        capacity = nr + PROC_RECORD_SLACK;
+    }
+
+    query->records = records;
+    query->records_capacity = capacity;
+    query->nr_records = min(nr, capacity);
+    query->nr_dropped = nr - query->nr_records;
+    return 0;
+}
+
+/**
+ * Return the iterator element at a position.
+ *
+ * @query: Pointer to the query whose records are iterated.
+ * @pos: Position in the output.
+ *
+ * @return: The record at the position, PROC_SUMMARY_TOKEN for the summary line after the last
+ *          record, or NULL past the end.
+ */
+static void *record_at(struct proc_info_query *query, loff_t pos)
+{
+    if (pos < (loff_t)query->nr_records)
+        return &query->records[pos];
+    if (pos == (loff_t)query->nr_records)
+        return PROC_SUMMARY_TOKEN;
+    return NULL;
+}
+
+/**
+ * Start callback function of the /proc file iterator.
+ *
+ * This function is called when the /proc file is read. At offset 0 it retrieves information
+ * about the queried process IDs and process names; at any offset it returns the record at the
+ * given position, so output of any size is streamed in page sized chunks.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @pos: Pointer to the position of the first record to show.
+ *
+ * @return: The record at the position, PROC_SUMMARY_TOKEN for the summary line, NULL at the end of
+ *          the output, or an error pointer on failure.
+ */
+static void *start_proc(struct seq_file *m, loff_t *pos)
+{
+    struct proc_info_query *query = m->private;
+    size_t i;
+    int err;
+
+    if (*pos == 0 && query_has_targets(query)) {
+        err = collect_records(query);
+        if (err)
+            return ERR_PTR(err);
+    }
+    // seq_file restarts at the same position when the output outgrows its buffer, so the
+    // benchmarks run once and show_proc only prints their results
+    if (*pos == 0 && !query->bench_done) {
+        for (i = 0; i < query->nr_bench; i++) {
+            run_format_benchmark(&query->bench[i]);
+            cond_resched();
+        }
+        query->bench_done = true;
+    }
+    return record_at(query, *pos);
+}
+
+/**
+ * Next callback function of the /proc file iterator.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record that was shown last.
+ * @pos: Pointer to the position of the record that was shown last.
+ *
+ * @return: The next record, PROC_SUMMARY_TOKEN for the summary line, or NULL at the end.
+ */
+static void *next_proc(struct seq_file *m, void *v, loff_t *pos)
+{
+    ++*pos;
+    return record_at(m->private, *pos);
+}
+
+/**
+ * Stop callback function of the /proc file iterator.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record that was shown last.
+ */
+static void stop_proc(struct seq_file *m, void *v)
+{
+}
+
+/**
+ * Show callback function of the /proc file iterator.
+ *
+ * This function writes one record, or the summary line, to the seq_file. Files in binary mode
+ * get the binary layout of the record and no summary line.
+ *
+ * @m: Pointer to the seq_file of the open /proc file.
+ * @v: The record to show.
+ *
+ * @return: Always 0.
+ */
+static int show_proc(struct seq_file *m, void *v)
+{
+    struct proc_info_query *query = m->private;
+    char text[PROC_RECORD_MAX];
+    struct proc_info_cursor cursor = { .buf = text, .len = 0, .size = sizeof(text) };
+    struct proc_info_bin_record bin;
+    const struct proc_info_record *record = v;
+    size_t i;
+
+    // Binary output carries only the records, consumers count them themselves
+    if (query->binary) {
+        if (v != PROC_SUMMARY_TOKEN) {
+            pack_process_record(v, &bin);
+            seq_write(m, &bin, sizeof(bin));
+        }
+        return 0;
+    }
+
+    if (v != PROC_SUMMARY_TOKEN) {
+        if (query->snapshot)
+            log_process_line(&cursor, v);
+        else if (query->tree && ((struct proc_info_record *)v)->found)
+            log_tree_line(&cursor, v);
+        else if (query->threads && ((struct proc_info_record *)v)->found)
+            log_thread_line(&cursor, v);
+        else
+            log_process_info(&cursor, v);
+        // A process found by a prefix or glob also names the pattern it matched
+        if (query->matcher.nr_wild && record->found && record->pattern)
+            cursor_printf(&cursor, "Pattern: %s\n", query->names[record->pattern - 1]);
+        seq_write(m, text, cursor.len);
+        return 0;
+    }
+
+    if (!query_has_targets(query) && query->nr_bench == 0)
+        cursor_printf(&cursor, "Error: No process given. Write pid=<PID> or name=<NAME> to /proc/%s.\n",
+                      PROC_FILENAME);
+    else if (query->filter.active || query->top_n)
+        cursor_printf(&cursor, "Tasks visited: %lu, matched: %lu\n", query->visited,
+                      query->matched);
+    else if (query_has_targets(query))
+        cursor_printf(&cursor, "Tasks visited: %lu\n", query->visited);
+    if (query->top_n)
+        cursor_printf(&cursor, "Top %lu by %s\n",
+                      min_t(unsigned long, query->top_n, query->matched),
+                      proc_top_keys[query->top_key].name);
+    if (query->tree && query->tree_count)
+        cursor_printf(&cursor, "Subtree of %d: %zu processes, total resident memory: %lu KB\n",
+                      query->tree_root, query->tree_count, query->tree_memory);
+    if (query->threads && query->thread_count)
+        cursor_printf(&cursor, "Threads of %d: %zu\n", query->threads_pid, query->thread_count);
+    if (query->nr_dropped)
+        cursor_printf(&cursor, "Warning: %zu records dropped, the task list kept growing.\n",
+                      query->nr_dropped);
+    seq_write(m, text, cursor.len);
+
+    for (i = 0; query->all_matches && query->matches && i < query->nr_names; i++) {
+        cursor.len = 0;
+        cursor_printf(&cursor, "Matches for %s: %zu, total resident memory: %lu KB\n",
+                      query->names[i], query->matches[i].count, query->matches[i].memory_usage);
+        seq_write(m, text, cursor.len);
+    }
+
+    for (i = 0; i < query->nr_bench; i++) {
+        cursor.len = 0;
+        log_format_benchmark(&cursor, &query->bench[i]);
+        seq_write(m, text, cursor.len);
+    }
+    return 0;
+}
+
+/**
+ * Write callback function for the /proc file.
+ *
+ * This function is called when the /proc file is written. It parses a query, see struct
+ * proc_info_query: "pid=", "name=", "pids=" and "names=" targets, where names may be prefixes
+ * or globs, with "match=all" and "format=binary"; "mode=snapshot" with its "uid=", "ppid=",
+ * "state=", "min_rss=", "max_rss=" and "kthread=" filters; "topn=" with "key="; "tree=",
+ * "threads=" or "bench=". The query replaces the query state of the open file, and the file
+ * offset is rewound so the next read reports the new targets.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the query.
+ * @count: Size of the user buffer.
+ * @offset: Pointer to the file offset.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_proc(struct file *file, const char __user *buffer, size_t count, loff_t *offset)
+{
+    struct seq_file *m = file->private_data;
+    struct proc_info_query *query = m->private;
+    struct proc_info_query parsed = {0};
+    char *kbuffer;
+    int err;
+
+    if (count == 0 || count > PROC_WRITE_MAX)
+        return -EINVAL;
+
+    kbuffer = memdup_user_nul(buffer, count);
+    if (IS_ERR(kbuffer))
+        return PTR_ERR(kbuffer);
+
+    err = parse_query(kbuffer, &parsed);
+    kfree(kbuffer);
+    // The sampler is configured through its own file
+    if (!err && parsed.sample)
+        err = -EINVAL;
+    if (err) {
+        free_query_targets(&parsed);
+        return err;
+    }
+
+    // Only replace the targets once the whole query parsed successfully
+    mutex_lock(&m->lock);
+    free_query_targets(query);
+    *query = parsed;
+    *offset = 0;
+    mutex_unlock(&m->lock);
+    return count;
+}
+
+/**
+ * Open callback function for the /proc file.
+ *
+ * This function is called when the /proc file is opened. It opens the seq_file of the /proc file
+ * and initializes its query state from the module parameters.
+ *
+ * @inode: Pointer to the inode of the /proc file.
+ * @file: Pointer to the file structure.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int open_proc(struct inode *inode, struct file *file)
+{
+    struct proc_info_query *query;
+
+    query = __seq_open_private(file, &proc_seq_ops, sizeof(*query));
+    if (!query)
+        return -ENOMEM;
+
+    if (upid != -1 || upname[0] != '\0') {
+        query->pids = kmalloc(sizeof(*query->pids), GFP_KERNEL);
+        query->names = kmalloc(sizeof(*query->names), GFP_KERNEL);
+        if (!query->pids || !query->names) {
+            free_query_targets(query);
+            seq_release_private(inode, file);
+            return -ENOMEM;
+        }
+
+        if (upid != -1)
+            query->pids[query->nr_pids++] = upid;
+        else
+            strscpy(query->names[query->nr_names++], upname, TASK_COMM_LEN);
+    }
+
+    return 0;
+}
+
+/**
+ * Release callback function for the /proc file.
+ *
+ * This function is called when the last reference to an open /proc file is dropped. It frees
+ * the query state and the seq_file of the file.
+ *
+ * @inode: Pointer to the inode of the /proc file.
+ * @file: Pointer to the file structure.
+ *
+ * @return: Always 0.
+ */
+static int release_proc(struct inode *inode, struct file *file)
+{
+    struct seq_file *m = file->private_data;
+
+    free_query_targets(m->private);
+    return seq_release_private(inode, file);
+}
+
+/**
+ * Allocate the slots of the sample rings.
+ *
+ * The rings are allocated when sampling first starts and kept until the module is unloaded, so
+ * readers never see them disappear. Must be called with proc_sampler_lock held.
+ *
+ * @return: 0 on success, or -ENOMEM on failure.
+ */
+static int alloc_sample_rings(void)
+{
+    struct proc_sample_ring *ring;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_sample_rings, cpu);
+        if (ring->slots)
+            continue;
+        ring->slots = kvcalloc(PROC_SAMPLE_SLOTS, sizeof(*ring->slots), GFP_KERNEL);
+        if (!ring->slots)
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * Free the slots of the sample rings once sampling has stopped for good.
+ */
+static void free_sample_rings(void)
+{
+    struct proc_sample_ring *ring;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_sample_rings, cpu);
+        kvfree(ring->slots);
+        ring->slots = NULL;
+    }
+}
+
+/**
+ * Store a sample in a ring, or count it as dropped if the ring is full.
+ *
+ * @ring: Pointer to the ring of the current CPU.
+ * @record: Pointer to the record to store.
+ *
+ * @return: true if the record was stored, false if it was dropped.
+ */
+static bool push_sample(struct proc_sample_ring *ring, const struct proc_info_record *record)
+{
+    unsigned long head = ring->head;
+
+    // Pairs with the release of tail in pop_sample, the slot is free once the reader moved past it
+    if (head - smp_load_acquire(&ring->tail) >= PROC_SAMPLE_SLOTS) {
+        WRITE_ONCE(ring->dropped, ring->dropped + 1);
+        return false;
+    }
+    ring->slots[head & (PROC_SAMPLE_SLOTS - 1)] = *record;
+    smp_store_release(&ring->head, head + 1);
+    return true;
+}
+
+/**
+ * Allocate the shared sample ring if it does not exist yet.
+ *
+ * The ring is zeroed by vmalloc_user and never freed while the module is loaded, so mappings
+ * and the sampler can use it without further locking. Must be called with proc_sampler_lock
+ * held.
+ *
+ * @return: 0 on success, or -ENOMEM on failure.
+ */
+static int alloc_shared_ring(void)
+{
+    struct proc_info_ring_header *ring;
+
+    if (proc_shared_ring)
+        return 0;
+
+    ring = vmalloc_user(PROC_SHARED_RING_SIZE);
+    if (!ring)
+        return -ENOMEM;
+    ring->version = PROC_INFO_RING_VERSION;
+    ring->record_size = sizeof(struct proc_info_bin_record);
+    ring->nr_slots = PROC_SHARED_RING_SLOTS;
+    ring->data_offset = PROC_SHARED_RING_DATA;
+    proc_shared_ring = ring;
+    return 0;
+}
+
+/**
+ * Store a sample in the shared ring, or count it as dropped if the ring is full.
+ *
+ * The consumer lives in user space and may write anything to tail, so the module keeps its own
+ * head and treats a tail that is not behind it as a full ring.
+ *
+ * @record: Pointer to the record to store.
+ *
+ * @return: true if the record was stored, false if it was dropped.
+ */
+static bool push_shared_sample(const struct proc_info_record *record)
+{
+    struct proc_info_ring_header *ring = proc_shared_ring;
+    struct proc_info_bin_record *slots = (void *)ring + PROC_SHARED_RING_DATA;
+    u32 head = proc_sampler.shared_head;
+
+    // Pairs with the release of tail by the consumer, the slot is free once it moved past it
+    if (head - smp_load_acquire(&ring->tail) >= PROC_SHARED_RING_SLOTS) {
+        WRITE_ONCE(ring->dropped, ++proc_sampler.shared_dropped);
+        return false;
+    }
+    pack_process_record(record, &slots[head & (PROC_SHARED_RING_SLOTS - 1)]);
+    proc_sampler.shared_head = head + 1;
+    smp_store_release(&ring->head, head + 1);
+    return true;
+}
+
+/**
+ * Find the ring holding the oldest sample.
+ *
+ * Each ring is ordered by time, so the oldest sample of all rings is the oldest head of a ring.
+ * Must be called with proc_sample_read_lock held.
+ *
+ * @return: The ring whose next sample is the oldest, or NULL if all rings are empty.
+ */
+static struct proc_sample_ring *oldest_sample_ring(void)
+{
+    struct proc_sample_ring *ring, *oldest = NULL;
+    const struct proc_info_record *record, *oldest_record = NULL;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_sample_rings, cpu);
+        // Pairs with the release of head in push_sample, the slot is written once head moved past it
+        if (ring->tail == smp_load_acquire(&ring->head))
+            continue;
+        record = &ring->slots[ring->tail & (PROC_SAMPLE_SLOTS - 1)];
+        if (!oldest || record->timestamp < oldest_record->timestamp) {
+            oldest = ring;
+            oldest_record = record;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * Check if a sample reader should stop waiting.
+ *
+ * @return: true if a sample is available or the sampler is stopped.
+ */
+static bool samples_ready(void)
+{
+    struct proc_sample_ring *ring;
+    int cpu;
+
+    if (!READ_ONCE(proc_sampler.interval))
+        return true;
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_sample_rings, cpu);
+        if (READ_ONCE(ring->tail) != smp_load_acquire(&ring->head))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Send the records of a sampling pass to the samples multicast group.
+ *
+ * Nothing is built while no socket listens to the group. A pass whose message cannot be
+ * allocated is not sent, the rings still hold its samples.
+ *
+ * @records: Records of the pass.
+ * @nr: Number of records.
+ */
+static void multicast_samples(const struct proc_info_record *records, size_t nr)
+{
+    struct sk_buff *skb;
+    void *hdr;
+    size_t i;
+
+    if (!genl_has_listeners(&proc_info_family, &init_net, 0))
+        return;
+
+    skb = genlmsg_new(nr * record_attrs_size(), GFP_KERNEL);
+    if (!skb)
+        return;
+    hdr = genlmsg_put(skb, 0, 0, &proc_info_family, 0, PROC_INFO_CMD_SAMPLES);
+    if (!hdr)
+        goto fail;
+    for (i = 0; i < nr; i++) {
+        if (records[i].found && put_record_attrs(skb, &records[i]))
+            goto fail;
+    }
+    genlmsg_end(skb, hdr);
+    genlmsg_multicast(&proc_info_family, skb, 0, 0, GFP_KERNEL);
+    return;
+
+fail:
+    nlmsg_free(skb);
+}
+
+/**
+ * Work function of the sampler.
+ *
+ * Every pass records the sampler targets in one RCU pass, like a read of the /proc file, and
+ * stores the found records in the ring of the current CPU and sends them to the netlink samples
+ * group. Deadlines advance by whole intervals, so a pass that runs late does not shift the passes
+ * after it.
+ *
+ * @work: The work item of the sampler.
+ */
+static void sample_work(struct work_struct *work)
+{
+    struct proc_sample_ring *ring;
+    size_t i, nr, stored = 0;
+    unsigned long now;
+
+    nr = collect_pass(&proc_sampler.query, proc_sampler.scratch, proc_sampler.capacity);
+    if (nr > proc_sampler.capacity) {
+        atomic_long_add(nr - proc_sampler.capacity, &proc_sampler.overflows);
+        nr = proc_sampler.capacity;
+    }
+
+    if (proc_sampler.shared) {
+        for (i = 0; i < nr; i++) {
+            if (proc_sampler.scratch[i].found && push_shared_sample(&proc_sampler.scratch[i]))
+                stored++;
+        }
+    } else {
+        ring = get_cpu_ptr(&proc_sample_rings);
+        for (i = 0; i < nr; i++) {
+            if (proc_sampler.scratch[i].found && push_sample(ring, &proc_sampler.scratch[i]))
+                stored++;
+        }
+        put_cpu_ptr(&proc_sample_rings);
+    }
+
+    atomic_long_add(stored, &proc_sampler.samples);
+    atomic_long_inc(&proc_sampler.passes);
+    wake_up_interruptible(&proc_sample_wait);
+    multicast_samples(proc_sampler.scratch, nr);
+
+    now = jiffies;
+    proc_sampler.next_tick += proc_sampler.interval;
+    if (time_before_eq(proc_sampler.next_tick, now)) {
+        // Skip the missed deadlines instead of running back to back passes
+        atomic_long_inc(&proc_sampler.late);
+        proc_sampler.next_tick = now + proc_sampler.interval;
+    }
+    schedule_delayed_work(&proc_sample_work, proc_sampler.next_tick - now);
+}
+
+/**
+ * Stop the sampler and free its targets. Must be called with proc_sampler_lock held.
+ */
+static void stop_sampler(void)
+{
+    // The work item requeues itself, cancelling waits for the running pass and drops the requeue
+    cancel_delayed_work_sync(&proc_sample_work);
+    WRITE_ONCE(proc_sampler.interval, 0);
+    free_query_targets(&proc_sampler.query);
+    kvfree(proc_sampler.scratch);
+    proc_sampler.scratch = NULL;
+    proc_sampler.capacity = 0;
+}
+
+/**
+ * Replace the sampler configuration.
+ *
+ * The running sampler is stopped first. A query with a non-zero interval then becomes the new
+ * sampler query and is sampled right away; a zero interval leaves the sampler stopped. Samples
+ * already in the rings are kept for readers.
+ *
+ * @query: Pointer to the parsed sampler query. Its targets are taken over on success and freed
+ *         otherwise.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int configure_sampler(struct proc_info_query *query)
+{
+    int err = 0;
+
+    mutex_lock(&proc_sampler_lock);
+    stop_sampler();
+
+    if (query->interval_ms) {
+        err = query->shared ? alloc_shared_ring() : alloc_sample_rings();
+        if (!err && query->nr_names) {
+            query->matches = kcalloc(query->nr_names, sizeof(*query->matches), GFP_KERNEL);
+            err = query->matches ? compile_name_matcher(query) : -ENOMEM;
+        }
+        if (!err) {
+            // Snapshots are sized once, processes created later are counted as overflows
+            proc_sampler.capacity = query_capacity(query);
+            proc_sampler.scratch = kvmalloc_array(proc_sampler.capacity,
+                                                  sizeof(*proc_sampler.scratch), GFP_KERNEL);
+            if (!proc_sampler.scratch) {
+                proc_sampler.capacity = 0;
+                err = -ENOMEM;
+            }
+        }
+    }
+
+    if (err || !query->interval_ms) {
+        free_query_targets(query);
+    } else {
+        proc_sampler.query = *query;
+        WRITE_ONCE(proc_sampler.binary, query->binary);
+        proc_sampler.shared = query->shared;
+        WRITE_ONCE(proc_sampler.interval, max(msecs_to_jiffies(query->interval_ms), 1UL));
+        proc_sampler.next_tick = jiffies;
+        schedule_delayed_work(&proc_sample_work, 0);
+    }
+    mutex_unlock(&proc_sampler_lock);
+
+    // Readers waiting on a stopped sampler return what is left
+    wake_up_interruptible(&proc_sample_wait);
+    return err;
+}
+
+/**
+ * Read callback function of the samples /proc file.
+ *
+ * This function drains samples from the rings, oldest first, as one text line or one binary
+ * record each. Only whole samples are returned. While the sampler runs, a read without any
+ * sample waits for the next pass unless the file is non-blocking; once it stops, the remaining
+ * samples are returned and then the end of the file.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer to copy the samples to.
+ * @count: Size of the user buffer.
+ * @offset: Unused, samples are consumed by reading them.
+ *
+ * @return: Number of bytes read, or a negative error code on failure.
+ */
+static ssize_t read_samples(struct file *file, char __user *buffer, size_t count, loff_t *offset)
+{
+    char text[PROC_RECORD_MAX];
+    struct proc_info_cursor cursor = { .buf = text, .len = 0, .size = sizeof(text) };
+    struct proc_info_bin_record bin;
+    struct proc_sample_ring *ring;
+    const struct proc_info_record *record;
+    const void *out;
+    size_t copied = 0, len;
+    ssize_t err = 0;
+
+    if (mutex_lock_interruptible(&proc_sample_read_lock))
+        return -ERESTARTSYS;
+
+    while (copied < count) {
+        ring = oldest_sample_ring();
+        if (!ring) {
+            if (copied || !READ_ONCE(proc_sampler.interval))
+                break;
+            if (file->f_flags & O_NONBLOCK) {
+                err = -EAGAIN;
+                break;
+            }
+            err = wait_event_interruptible(proc_sample_wait, samples_ready());
+            if (err)
+                break;
+            continue;
+        }
+
+        record = &ring->slots[ring->tail & (PROC_SAMPLE_SLOTS - 1)];
+        if (READ_ONCE(proc_sampler.binary)) {
+            pack_process_record(record, &bin);
+            out = &bin;
+            len = sizeof(bin);
+        } else {
+            cursor.len = 0;
+            log_sample_line(&cursor, record);
+            out = text;
+            len = cursor.len;
+        }
+
+        if (len > count - copied) {
+            if (!copied)
+                err = -EINVAL;
+            break;
+        }
+        if (copy_to_user(buffer + copied, out, len)) {
+            err = -EFAULT;
+            break;
+        }
+        copied += len;
+        // Pairs with the acquire of tail in push_sample, the slot may be reused from here on
+        smp_store_release(&ring->tail, ring->tail + 1);
+    }
+
+    mutex_unlock(&proc_sample_read_lock);
+    return copied ? copied : err;
+}
+
+/**
+ * Mmap callback function of the samples /proc file.
+ *
+ * This function maps the shared sample ring, allocating it on first use. Only shared mappings
+ * from offset 0 are accepted, since the consumer publishes its progress by writing tail.
+ *
+ * @file: Pointer to the file structure.
+ * @vma: The user space area to map the ring into.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int mmap_samples(struct file *file, struct vm_area_struct *vma)
+{
+    int err;
+
+    if (vma->vm_pgoff != 0 || !(vma->vm_flags & VM_MAYSHARE))
+        return -EINVAL;
+
+    mutex_lock(&proc_sampler_lock);
+    err = alloc_shared_ring();
+    mutex_unlock(&proc_sampler_lock);
+    if (err)
+        return err;
+
+    // The mapped pages hold their own references, so a mapping outlives the ring if it is freed first
+    return remap_vmalloc_range(vma, proc_shared_ring, 0);
+}
+
+/**
+ * Write callback function of the samples /proc file.
+ *
+ * This function parses a sampler query, made of the targets and options of a /proc file query
+ * and an "interval=<MS>" item, and reconfigures the sampler with it.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the query.
+ * @count: Size of the user buffer.
+ * @offset: Unused.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_samples(struct file *file, const char __user *buffer, size_t count,
+                             loff_t *offset)
+{
+    struct proc_info_query parsed = {0};
+    char *kbuffer;
+    int err;
+
+    if (count == 0 || count > PROC_WRITE_MAX)
+        return -EINVAL;
+
+    kbuffer = memdup_user_nul(buffer, count);
+    if (IS_ERR(kbuffer))
+        return PTR_ERR(kbuffer);
+
+    err = parse_query(kbuffer, &parsed);
+    kfree(kbuffer);
+    if (!err && !parsed.sample)
+        err = -EINVAL;
+    if (err) {
+        free_query_targets(&parsed);
+        return err;
+    }
+
+    err = configure_sampler(&parsed);
+    return err ? err : count;
+}
+
+/**
+ * Allocate the slots of the event rings that have none yet. Must be called with proc_event_lock
+ * held.
+ *
+ * @return: 0 on success, or -ENOMEM on failure.
+ */
+static int alloc_event_rings(void)
+{
+    struct proc_event_ring *ring;
+    struct proc_info_event *slots;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_event_rings, cpu);
+        if (ring->slots)
+            continue;
+        slots = kvcalloc(PROC_EVENT_SLOTS, sizeof(*slots), GFP_KERNEL);
+        if (!slots)
+            return -ENOMEM;
+        WRITE_ONCE(ring->slots, slots);
+    }
+    return 0;
+}
+
+/**
+ * Free the slots of the event rings once the tracepoint probes are unhooked.
+ */
+static void free_event_rings(void)
+{
+    struct proc_event_ring *ring;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_event_rings, cpu);
+        kvfree(ring->slots);
+        ring->slots = NULL;
+    }
+}
+
+/**
+ * Find the ring holding the oldest unread event.
+ *
+ * @return: The ring, or NULL if every ring is empty.
+ */
+static struct proc_event_ring *oldest_event_ring(void)
+{
+    struct proc_event_ring *ring, *oldest = NULL;
+    const struct proc_info_event *event, *oldest_event = NULL;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_event_rings, cpu);
+        // Pairs with the release of head in record_event, the slot is written once head moved past it
+        if (!ring->slots || ring->tail == smp_load_acquire(&ring->head))
+            continue;
+        event = &ring->slots[ring->tail & (PROC_EVENT_SLOTS - 1)];
+        if (!oldest || event->timestamp < oldest_event->timestamp) {
+            oldest = ring;
+            oldest_event = event;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * Check if an event reader should stop waiting.
+ *
+ * @return: true if an event is available or the module is being unloaded.
+ */
+static bool events_ready(void)
+{
+    struct proc_event_ring *ring;
+    int cpu;
+
+    if (READ_ONCE(proc_events.closing))
+        return true;
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&proc_event_rings, cpu);
+        if (READ_ONCE(ring->tail) != smp_load_acquire(&ring->head))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Open callback function of the events /proc file.
+ *
+ * This function starts recording process events when the first events file is opened, with
+ * empty rings, and sets the file up for text output.
+ *
+ * @inode: Pointer to the inode structure.
+ * @file: Pointer to the file structure.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int open_events(struct inode *inode, struct file *file)
+{
+    struct proc_event_reader *reader;
+    struct proc_event_ring *ring;
+    int cpu, err;
+
+    // The events come from the tracepoint probes of the process index
+    if (!proc_index_ready)
+        return -EOPNOTSUPP;
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+        return -ENOMEM;
+
+    mutex_lock(&proc_event_lock);
+    err = alloc_event_rings();
+    if (err) {
+        mutex_unlock(&proc_event_lock);
+        kfree(reader);
+        return err;
+    }
+    if (atomic_read(&proc_events.readers) == 0) {
+        // Events left from an earlier reader are stale, without readers no one holds the read lock
+        mutex_lock(&proc_event_read_lock);
+        for_each_possible_cpu(cpu) {
+            ring = per_cpu_ptr(&proc_event_rings, cpu);
+            smp_store_release(&ring->tail, smp_load_acquire(&ring->head));
+        }
+        mutex_unlock(&proc_event_read_lock);
+    }
+    reader->reported = events_dropped();
+    atomic_inc(&proc_events.readers);
+    mutex_unlock(&proc_event_lock);
+
+    file->private_data = reader;
+    return nonseekable_open(inode, file);
+}
+
+/**
+ * Read callback function of the events /proc file.
+ *
+ * This function drains events from the rings, oldest first, as one text line or one binary
+ * record each, after a record counting the events dropped since the previous read if any. A
+ * read without any event waits for the next one unless the file is non-blocking.
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer to copy the events to.
+ * @count: Size of the user buffer.
+ * @offset: Unused, events are consumed by reading them.
+ *
+ * @return: Number of bytes read, or a negative error code on failure.
+ */
+static ssize_t read_events(struct file *file, char __user *buffer, size_t count, loff_t *offset)
+{
+    struct proc_event_reader *reader = file->private_data;
+    char text[PROC_RECORD_MAX];
+    struct proc_info_cursor cursor = { .buf = text, .len = 0, .size = sizeof(text) };
+    struct proc_info_event_record bin;
+    struct proc_info_event lost = { .type = PROC_INFO_EVENT_LOST };
+    struct proc_event_ring *ring;
+    const struct proc_info_event *event;
+    unsigned long dropped;
+    const void *out;
+    size_t copied = 0, len;
+    ssize_t err = 0;
+
+    if (mutex_lock_interruptible(&proc_event_read_lock))
+        return -ERESTARTSYS;
+
+    // Losses are reported once per read, ahead of the events that were kept
+    dropped = events_dropped();
+    lost.lost = dropped - reader->reported;
+
+    while (copied < count) {
+        if (lost.lost) {
+            ring = NULL;
+            lost.timestamp = ktime_get_ns();
+            event = &lost;
+        } else {
+            ring = oldest_event_ring();
+            if (!ring) {
+                if (copied || READ_ONCE(proc_events.closing))
+                    break;
+                if (file->f_flags & O_NONBLOCK) {
+                    err = -EAGAIN;
+                    break;
+                }
+                err = wait_event_interruptible(proc_event_wait, events_ready());
+                if (err)
+                    break;
+                continue;
+            }
+            event = &ring->slots[ring->tail & (PROC_EVENT_SLOTS - 1)];
+        }
+
+        if (READ_ONCE(reader->binary)) {
+            pack_event_record(event, &bin);
+            out = &bin;
+            len = sizeof(bin);
+        } else {
+            cursor.len = 0;
+            log_event_line(&cursor, event);
+            out = text;
+            len = cursor.len;
+        }
+
+        if (len > count - copied) {
+            if (!copied)
+                err = -EINVAL;
+            break;
+        }
+        if (copy_to_user(buffer + copied, out, len)) {
+            err = -EFAULT;
+            break;
+        }
+        copied += len;
+        if (ring) {
+            // Pairs with the acquire of tail in record_event, the slot may be reused from here on
+            smp_store_release(&ring->tail, ring->tail + 1);
+        } else {
+            reader->reported = dropped;
+            lost.lost = 0;
+        }
+    }
+
+    mutex_unlock(&proc_event_read_lock);
+    return copied ? copied : err;
+}
+
+/**
+ * Write callback function of the events /proc file.
+ *
+ * This function switches the open file between text and binary output, on "format=text" and
+ * "format=binary".
+ *
+ * @file: Pointer to the file structure.
+ * @buffer: User buffer holding the format.
+ * @count: Size of the user buffer.
+ * @offset: Unused.
+ *
+ * @return: Number of bytes consumed, or a negative error code on failure.
+ */
+static ssize_t write_events(struct file *file, const char __user *buffer, size_t count,
+                            loff_t *offset)
+{
+    struct proc_event_reader *reader = file->private_data;
+    char *kbuffer;
+    int err = 0;
+
+    if (count == 0 || count > PROC_WRITE_MAX)
+        return -EINVAL;
+
+    kbuffer = memdup_user_nul(buffer, count);
+    if (IS_ERR(kbuffer))
+        return PTR_ERR(kbuffer);
+
+    if (sysfs_streq(kbuffer, "format=binary"))
+        WRITE_ONCE(reader->binary, true);
+    else if (sysfs_streq(kbuffer, "format=text"))
+        WRITE_ONCE(reader->binary, false);
+    else
+        err = -EINVAL;
+    kfree(kbuffer);
+    return err ? err : count;
+}
+
+/**
+ * Release callback function of the events /proc file.
+ *
+ * This function stops recording process events when the last events file is closed.
+ *
+ * @inode: Pointer to the inode structure.
+ * @file: Pointer to the file structure.
+ *
+ * @return: Always 0.
+ */
+static int release_events(struct inode *inode, struct file *file)
+{
+    mutex_lock(&proc_event_lock);
+    atomic_dec(&proc_events.readers);
+    mutex_unlock(&proc_event_lock);
+    kfree(file->private_data);
+    return 0;
+}
+
+/**
+ * Handler of PROC_INFO_CMD_GET generic netlink requests.
+ *
+ * This function answers a request for one process ID or name, like a query written to the /proc
+ * file, with one PROC_INFO_CMD_RECORDS message holding a nested attribute per record.
+ *
+ * @skb: The request message.
+ * @info: Attributes and sender of the request.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int get_proc_nl(struct sk_buff *skb, struct genl_info *info)
+{
+    struct proc_info_query query = {0};
+    char name[TASK_COMM_LEN];
+    struct sk_buff *reply;
+    void *hdr;
+    size_t i;
+    int pid, err;
+
+    if (!info->attrs[PROC_INFO_ATTR_PID] == !info->attrs[PROC_INFO_ATTR_NAME]) {
+        GENL_SET_ERR_MSG(info, "exactly one of PID and name is required");
+        return -EINVAL;
+    }
+
+    // The targets live on the stack, so the query is released field by field below
+    if (info->attrs[PROC_INFO_ATTR_PID]) {
+        pid = nla_get_s32(info->attrs[PROC_INFO_ATTR_PID]);
+        if (pid < 0)
+            return -EINVAL;
+        query.pids = &pid;
+        query.nr_pids = 1;
+    } else {
+        nla_strscpy(name, info->attrs[PROC_INFO_ATTR_NAME], sizeof(name));
+        query.names = &name;
+        query.nr_names = 1;
+    }
+    query.all_matches = nla_get_flag(info->attrs[PROC_INFO_ATTR_ALL]);
+
+    err = collect_records(&query);
+    if (err)
+        goto out;
+
+    reply = genlmsg_new(nla_total_size_64bit(sizeof(u64)) + query.nr_records * record_attrs_size(),
+                        GFP_KERNEL);
+    if (!reply) {
+        err = -ENOMEM;
+        goto out;
+    }
+    hdr = genlmsg_put_reply(reply, info, &proc_info_family, 0, PROC_INFO_CMD_RECORDS);
+    if (!hdr ||
+        nla_put_u64_64bit(reply, PROC_INFO_ATTR_VISITED, query.visited, PROC_INFO_ATTR_PAD)) {
+        nlmsg_free(reply);
+        err = -EMSGSIZE;
+        goto out;
+    }
+    for (i = 0; i < query.nr_records; i++) {
+        err = put_record_attrs(reply, &query.records[i]);
+        if (err) {
+            nlmsg_free(reply);
+            goto out;
+        }
+    }
+    genlmsg_end(reply, hdr);
+    err = genlmsg_reply(reply, info);
+
+out:
+    put_record_buffer(query.records, query.records_capacity);
+    kfree(query.matches);
+    free_name_matcher(&query.matcher);
+    return err;
+}
+
+// Attributes accepted in requests, the record fields are only sent by the module
+static const struct nla_policy proc_info_genl_policy[PROC_INFO_ATTR_MAX + 1] = {
+    [PROC_INFO_ATTR_PID] = { .type = NLA_S32 },
+    [PROC_INFO_ATTR_NAME] = { .type = NLA_NUL_STRING, .len = TASK_COMM_LEN - 1 },
+    [PROC_INFO_ATTR_ALL] = { .type = NLA_FLAG },
+};
+
+// Commands of the generic netlink family, queries are open to everyone like the /proc file
+static const struct genl_small_ops proc_info_genl_ops[] = {
+    {
+        .cmd = PROC_INFO_CMD_GET,
+        .doit = get_proc_nl,
+    },
+};
+
+// Multicast groups of the generic netlink family, the group ID is the index
+static const struct genl_multicast_group proc_info_genl_mcgrps[] = {
+    { .name = PROC_INFO_GENL_MCGRP_SAMPLES },
+};
+
+static struct genl_family proc_info_family = {
+    .name = PROC_INFO_GENL_NAME,
+    .version = PROC_INFO_GENL_VERSION,
+    .maxattr = PROC_INFO_ATTR_MAX,
+    .policy = proc_info_genl_policy,
+    .module = THIS_MODULE,
+    .small_ops = proc_info_genl_ops,
+    .n_small_ops = ARRAY_SIZE(proc_info_genl_ops),
+    .mcgrps = proc_info_genl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(proc_info_genl_mcgrps),
+};
+
+/**
+ * Initialization function for the module.
+ *
+ * This function is called when the module is loaded into the kernel. It builds the process index,
+ * registers the generic netlink family, creates the /proc file entries and registers the file
+ * callback functions.
+ *
+ * @return: 0 on success, or a negative error code on failure.
+ */
+static int proc_info_module_init(void)
+{
+    int err;
+
+    BUILD_BUG_ON(PROC_INFO_COMM_LEN != TASK_COMM_LEN);
+    BUILD_BUG_ON(1 + ilog2(TASK_REPORT_MAX) != ARRAY_SIZE(proc_task_states));
+    BUILD_BUG_ON(sizeof(struct proc_info_ring_header) > PROC_SHARED_RING_DATA);
+
+    // Name queries fall back to scanning the task list if the index cannot be hooked up
+    err = process_index_init();
+    if (err)
+        printk(KERN_WARNING "proc_info_module: process index disabled (%d)\n", err);
+    record_pool_init();
+
+    // Registered before the samples file, so the sampler always finds the multicast group
+    err = genl_register_family(&proc_info_family);
+    if (err) {
+        printk(KERN_ERR "Failed to register generic netlink family %s\n", PROC_INFO_GENL_NAME);
+        goto fail;
+    }
+
+    // Queries only change the state of the writer's own open file, so anyone may write one
+    err = -ENOMEM;
+    proc_file_entry = proc_create(PROC_FILENAME, 0666, NULL, &proc_fops);
+    if (!proc_file_entry) {
+        printk(KERN_ERR "Failed to create /proc/%s entry\n", PROC_FILENAME);
+        goto fail_file;
+    }
+
+    proc_stats_entry = proc_create_single(PROC_STATS_FILENAME, 0444, NULL, show_stats);
+    if (!proc_stats_entry) {
+        printk(KERN_ERR "Failed to create /proc/%s entry\n", PROC_STATS_FILENAME);
+        goto fail_stats;
+    }
+
+    // Every reader drains the same rings, so only root may read samples or reconfigure the sampler
+    proc_samples_entry = proc_create(PROC_SAMPLES_FILENAME, 0600, NULL, &proc_samples_fops);
+    if (!proc_samples_entry) {
+        printk(KERN_ERR "Failed to create /proc/%s entry\n", PROC_SAMPLES_FILENAME);
+        goto fail_samples;
+    }
+
+    // Every reader drains the same rings, so only root may take events from the monitoring agent
+    proc_events_entry = proc_create(PROC_EVENTS_FILENAME, 0600, NULL, &proc_events_fops);
+    if (!proc_events_entry) {
+        printk(KERN_ERR "Failed to create /proc/%s entry\n", PROC_EVENTS_FILENAME);
+        goto fail_events;
+    }
+
+    printk(KERN_INFO "proc_info_module loaded\n");
+    return 0;
+
+fail_events:
+    remove_proc_entry(PROC_SAMPLES_FILENAME, NULL);
+fail_samples:
+    remove_proc_entry(PROC_STATS_FILENAME, NULL);
+fail_stats:
+    remove_proc_entry(PROC_FILENAME, NULL);
+fail_file:
+    genl_unregister_family(&proc_info_family);
+fail:
+    record_pool_exit();
+    process_index_exit();
+    return err;
+}
+
+/**
+ * Cleanup function for the module.
+ *
+ * This function is called when the module is unloaded from the kernel. It stops the sampler and
+ * removes the /proc file entries, the generic netlink family and the process index.
+ */
+static void proc_info_module_exit(void)
+{
+    // Stopping the sampler first lets blocked readers return before their file is removed
+    mutex_lock(&proc_sampler_lock);
+    stop_sampler();
+    mutex_unlock(&proc_sampler_lock);
+    wake_up_interruptible(&proc_sample_wait);
+    remove_proc_entry(PROC_SAMPLES_FILENAME, NULL);
+    free_sample_rings();
+    vfree(proc_shared_ring);
+
+    // Likewise for event readers, which wait as long as their file is open
+    WRITE_ONCE(proc_events.closing, true);
+    wake_up_interruptible(&proc_event_wait);
+    remove_proc_entry(PROC_EVENTS_FILENAME, NULL);
+
+    remove_proc_entry(PROC_STATS_FILENAME, NULL);
+    remove_proc_entry(PROC_FILENAME, NULL);
+    // Waits for running requests, which use the record pool
+    genl_unregister_family(&proc_info_family);
+    record_pool_exit();
+    process_index_exit();
+    // The probes record events until they are unhooked
+    free_event_rings();
+    printk(KERN_INFO "proc_info_module unloaded\n");
+}
+
+// Module initialization and cleanup macros
+module_init(proc_info_module_init);
+module_exit(proc_info_module_exit);
+
+// Module parameters and their descriptions
+module_param(upid, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(upid, "User process ID");
+
+module_param_string(upname, upname, TASK_COMM_LEN, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(upname, "User process name");
+
+module_param(use_index, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(use_index, "Resolve process names through the process index instead of scanning");
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Dynamic Kernel Module");
+MODULE_AUTHOR("Burak Keçeci & Berkan Gönülsever");
+
+
+
+
@@ -0,0 +1,195 @@
+/*
+ * Shared Definitions - proc_info_module.h
+ *
+ * This header describes the binary interface of proc_info_module.c. It is included by the kernel
+ * module and by the wrapper user space application, so both sides agree on the record layout.
+ *
+ * Binary Records:
+ *  - Writing "format=binary" to the /proc file switches that open file from text output to a
+ *    stream of struct proc_info_bin_record, one per process or unmatched target.
+ *  - Every record starts with its version and size, and always advances by the size field. Fields
+ *    are only ever appended, and the version grows with every addition. A reader accepts any record
+ *    whose version is at least the one it was built against and whose size covers the struct it
+ *    knows, copies that prefix and ignores the rest. Only records of an older version are skipped.
+ *    Event records follow the same rule with PROC_INFO_EVENT_VERSION.
+ *  - The layout is packed and uses fixed-width types, and all fields are naturally aligned.
+ *  - Samples read from /proc/proc_info_module_samples use the same record when the sampler query
+ *    holds "format=binary".
+ *
+ * Shared Sample Ring:
+ *  - Mapping /proc/proc_info_module_samples with mmap(MAP_SHARED) at offset 0 maps a ring of binary
+ *    records, preceded by struct proc_info_ring_header. A sampler query holding "ring=shared" stores
+ *    its samples there instead of the per-CPU rings drained by read.
+ *  - The module advances head after writing a record and the consumer advances tail after reading
+ *    one, both with release semantics; the other side loads them with acquire semantics. Slot i is
+ *    at data_offset + (i % nr_slots) * record_size, head and tail grow freely and wrap at 2^32.
+ *  - A full ring drops new samples and counts them in dropped. Map the first page to learn the
+ *    size of the whole mapping, data_offset + nr_slots * record_size.
+ *  - There is a single ring, so only one consumer may advance tail at a time.
+ *  - Readers of the samples file share the module's rings, so the file is only accessible to root.
+ *
+ * Process Events:
+ *  - While /proc/proc_info_module_events is open, the module records the fork, exec and exit of every
+ *    process. Reading the file drains the events, oldest first, as text lines, or as struct
+ *    proc_info_event_record after writing "format=binary" to the open file.
+ *  - Events that do not fit in the buffer are dropped. The next read then starts with a
+ *    PROC_INFO_EVENT_LOST record counting the events dropped since the previous one.
+ *  - All open files drain the same buffer, so the file is only accessible to root.
+ *
+ * Generic Netlink:
+ *  - The module registers the generic netlink family PROC_INFO_GENL_NAME. A PROC_INFO_CMD_GET
+ *    request holds either PROC_INFO_ATTR_PID or PROC_INFO_ATTR_NAME, and PROC_INFO_ATTR_ALL to
+ *    report every process with that name. It is answered by one PROC_INFO_CMD_RECORDS message with
+ *    the request's sequence number, so requests can be pipelined over one socket.
+ *  - A records message holds PROC_INFO_ATTR_VISITED and one nested PROC_INFO_ATTR_RECORD per
+ *    process or unmatched target. The nested attributes carry the fields of the binary record.
+ *  - While the sampler runs, every pass is also sent to the multicast group
+ *    PROC_INFO_GENL_MCGRP_SAMPLES as a PROC_INFO_CMD_SAMPLES message of the same shape.
+ *
+ * Authors:
+ * - [ Burak Keçeci - 290201103 ][ Berkan Gönülsever - 270201064 ]
+ *
+ * License: GPL
+ */
+
+#ifndef PROC_INFO_MODULE_H
+#define PROC_INFO_MODULE_H
+
+#include <linux/types.h> // Needed for the fixed-width types in kernel and user space
+
+#define PROC_INFO_RECORD_VERSION 8
+#define PROC_INFO_COMM_LEN 16  // Same as TASK_COMM_LEN
+
+// Flags of a binary record
+#define PROC_INFO_RECORD_FOUND 0x1  // The target matched a process; otherwise only pid or comm is set
+#define PROC_INFO_RECORD_HAS_MM 0x2  // The process has a user address space; otherwise memory fields are 0
+
+/*
+ * Fixed-size binary record of one process.
+ */
+struct proc_info_bin_record {
+    __u16 version;  // PROC_INFO_RECORD_VERSION
+    __u16 size;  // Size of the record in bytes
+    __u32 flags;  // PROC_INFO_RECORD_* flags
+    __s32 pid;  // Process ID, or the queried ID if not found
+    __s32 ppid;  // Parent process ID, -1 if there is no parent
+    __u32 uid;  // User identifier
+    __u32 state;  // Raw task state
+    __u64 memory_usage;  // Resident memory (RSS) in KB
+    char comm[PROC_INFO_COMM_LEN];  // Process name, or the queried name if not found
+    // Version 2
+    __u64 rss_anon;  // Resident anonymous memory in KB
+    __u64 rss_file;  // Resident file-backed memory in KB
+    __u64 rss_shmem;  // Resident shared memory in KB
+    __u64 vm_size;  // Virtual memory size in KB
+    // Version 3
+    __u64 timestamp;  // Time the record was taken in ns since boot (CLOCK_MONOTONIC), 0 if not found
+    // Version 4
+    __u32 depth;  // Generations below the root of a tree query, 0 otherwise
+    __u32 reserved;  // Keeps the record size a multiple of 8, always 0
+    // Version 5
+    __u64 utime;  // CPU time spent in user mode in ns
+    __u64 stime;  // CPU time spent in kernel mode in ns
+    // Version 6
+    __u64 start_time;  // Start time in ns since boot (CLOCK_BOOTTIME)
+    __u64 nvcsw;  // Voluntary context switches
+    __u64 nivcsw;  // Involuntary context switches
+    __u64 run_delay;  // Time spent waiting on a run queue in ns, 0 without CONFIG_SCHED_INFO
+    // Version 7
+    __u8 state_index;  // Reported state, bit number in TASK_REPORT as returned by task_state_index()
+    char state_char;  // Reported state as its ps letter: R, S, D, T, t, X, Z, P or I
+    // Version 8
+    __u16 pattern;  // Number of the queried name or pattern the process matched, from 1; 0 for other records
+    __u8 reserved2[4];  // Keeps the record size a multiple of 8, always 0
+} __attribute__((packed));
+
+#define PROC_INFO_RING_VERSION 1
+
+/*
+ * Header of the shared sample ring, at the start of the mapping.
+ *
+ * The indices are kept in separate cache lines, so the module and the consumer do not contend
+ * for one line while updating them.
+ */
+struct proc_info_ring_header {
+    __u32 version;  // PROC_INFO_RING_VERSION
+    __u32 record_size;  // Size of a slot, sizeof(struct proc_info_bin_record)
+    __u32 nr_slots;  // Number of slots, a power of 2
+    __u32 data_offset;  // Offset of the first slot from the start of the mapping, page aligned
+    __u32 head __attribute__((aligned(64)));  // Next slot written by the module
+    __u32 tail __attribute__((aligned(64)));  // Next slot read by the consumer
+    __u64 dropped __attribute__((aligned(64)));  // Samples lost because the ring was full
+};
+
+#define PROC_INFO_EVENT_VERSION 1
+
+// Types of an event record
+#define PROC_INFO_EVENT_FORK 1  // A process was created
+#define PROC_INFO_EVENT_EXEC 2  // A process executed a new program
+#define PROC_INFO_EVENT_EXIT 3  // The last thread of a process exited
+#define PROC_INFO_EVENT_LOST 4  // Events were dropped because the reader fell behind
+
+/*
+ * Fixed-size binary record of one process event.
+ */
+struct proc_info_event_record {
+    __u16 version;  // PROC_INFO_EVENT_VERSION
+    __u16 size;  // Size of the record in bytes
+    __u16 type;  // PROC_INFO_EVENT_* type
+    __u16 reserved;  // Always 0
+    __s32 pid;  // Process ID
+    __s32 ppid;  // Parent process ID
+    __s32 exit_code;  // Wait status of an exit event as reported by waitpid, 0 otherwise
+    __u32 lost;  // Events dropped since the previous record, for PROC_INFO_EVENT_LOST
+    __u64 timestamp;  // Time of the event in ns since boot (CLOCK_MONOTONIC)
+    __u64 peak_rss;  // Peak resident memory in KB, of the whole lifetime for exit events
+    char comm[PROC_INFO_COMM_LEN];  // Process name, the new program for exec events
+} __attribute__((packed));
+
+#define PROC_INFO_GENL_NAME "PROC_INFO"
+#define PROC_INFO_GENL_VERSION 1
+#define PROC_INFO_GENL_MCGRP_SAMPLES "samples"
+
+// Generic netlink commands
+enum proc_info_cmd {
+    PROC_INFO_CMD_UNSPEC,
+    PROC_INFO_CMD_GET,  // Request: query one PID or name
+    PROC_INFO_CMD_RECORDS,  // Reply to PROC_INFO_CMD_GET
+    PROC_INFO_CMD_SAMPLES,  // Multicast: records of one sampler pass
+    __PROC_INFO_CMD_MAX,
+};
+#define PROC_INFO_CMD_MAX (__PROC_INFO_CMD_MAX - 1)
+
+// Generic netlink attributes, the record fields are only used nested in PROC_INFO_ATTR_RECORD
+enum proc_info_attr {
+    PROC_INFO_ATTR_UNSPEC,
+    PROC_INFO_ATTR_PAD,
+    PROC_INFO_ATTR_PID,  // s32: process ID, or the queried ID if not found
+    PROC_INFO_ATTR_NAME,  // string: process name, or the queried name if not found
+    PROC_INFO_ATTR_ALL,  // flag: report every process with the queried name
+    PROC_INFO_ATTR_VISITED,  // u64: processes visited by the query
+    PROC_INFO_ATTR_RECORD,  // nested: one process or unmatched target
+    PROC_INFO_ATTR_FOUND,  // flag: the target matched a process
+    PROC_INFO_ATTR_HAS_MM,  // flag: the process has a user address space
+    PROC_INFO_ATTR_PPID,  // s32: parent process ID, -1 if there is no parent
+    PROC_INFO_ATTR_UID,  // u32: user identifier
+    PROC_INFO_ATTR_STATE,  // u32: raw task state
+    PROC_INFO_ATTR_STATE_CHAR,  // u8: reported state as its ps letter
+    PROC_INFO_ATTR_RSS,  // u64: resident memory in KB
+    PROC_INFO_ATTR_RSS_ANON,  // u64: resident anonymous memory in KB
+    PROC_INFO_ATTR_RSS_FILE,  // u64: resident file-backed memory in KB
+    PROC_INFO_ATTR_RSS_SHMEM,  // u64: resident shared memory in KB
+    PROC_INFO_ATTR_VM_SIZE,  // u64: virtual memory size in KB
+    PROC_INFO_ATTR_TIMESTAMP,  // u64: time the record was taken in ns since boot (CLOCK_MONOTONIC)
+    PROC_INFO_ATTR_UTIME,  // u64: CPU time spent in user mode in ns
+    PROC_INFO_ATTR_STIME,  // u64: CPU time spent in kernel mode in ns
+    PROC_INFO_ATTR_START_TIME,  // u64: start time in ns since boot (CLOCK_BOOTTIME)
+    PROC_INFO_ATTR_NVCSW,  // u64: voluntary context switches
+    PROC_INFO_ATTR_NIVCSW,  // u64: involuntary context switches
+    PROC_INFO_ATTR_RUN_DELAY,  // u64: time spent waiting on a run queue in ns
+    PROC_INFO_ATTR_PATTERN,  // u16: number of the queried name or pattern the process matched, from 1
+    __PROC_INFO_ATTR_MAX,
+};
+#define PROC_INFO_ATTR_MAX (__PROC_INFO_ATTR_MAX - 1)
+
+#endif // PROC_INFO_MODULE_H